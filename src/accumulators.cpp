@@ -200,15 +200,9 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint)
         }
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex)) {
-            LogPrint("zero","%s: failed to read block from disk\n", __func__);
-            return false;
-        }
-
         std::list<PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins)) {
-            LogPrint("zero","%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
+        if (!BlockIndexToPubcoinList(pindex, listPubcoins)) {
+            LogPrint("zero","%s: failed to get zerocoin mintlist from block %d\n", __func__, pindex->nHeight);
             return false;
         }
 
@@ -247,7 +241,9 @@ bool InvalidCheckpointRange(int nHeight)
     return nHeight > Params().Zerocoin_Block_LastGoodCheckpoint() && nHeight < Params().Zerocoin_Block_RecalculateAccumulators();
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError)
+//Find where the witness walk of a mint starts: the accumulator right before the cluster of blocks containing the mint
+//was added to it, and the number of mints of the denomination that accumulator already holds
+static bool InitAccumulatorWitnessState(const PublicCoin& coin, CAccumulatorWitnessState& state)
 {
     uint256 txid;
     if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid)) {
@@ -262,7 +258,12 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
         return false;
     }
 
-    int nHeightMintAdded= mapBlockIndex[hashBlock]->nHeight;
+    if (!mapBlockIndex.count(hashBlock) || !chainActive.Contains(mapBlockIndex.at(hashBlock))) {
+        LogPrint("zero","%s mint is not in the active chain\n", __func__);
+        return false;
+    }
+
+    int nHeightMintAdded = mapBlockIndex.at(hashBlock)->nHeight;
     uint256 nCheckpointBeforeMint = 0;
     CBlockIndex* pindex = chainActive[nHeightMintAdded];
     int nChanges = 0;
@@ -299,94 +300,206 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
     CBigNum bnAccValue = 0;
-    if (GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue)) {
-        if (bnAccValue > 0) {
-            accumulator.setValue(bnAccValue);
-            witness.resetValue(accumulator, coin);
-        }
+    if (!GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue) || bnAccValue <= 0)
+        bnAccValue = Params().Zerocoin_Params()->accumulatorParams.accumulatorBase;
+
+    // calculate how many mints of this denomination existed in the accumulator we initialized
+    int nMintsBeforeStart = 0;
+    pindex = chainActive[GetZerocoinStartHeight()];
+    while (pindex->nHeight < nAccStartHeight) {
+        nMintsBeforeStart += pindex->mintsInBlock.Count(coin.getDenomination());
+        pindex = chainActive[pindex->nHeight + 1];
     }
 
-    //security level: this is an important prevention of tracing the coins via timing. Security level represents how many checkpoints
-    //of accumulated coins are added *beyond* the checkpoint that the mint being spent was added too. If each spend added the exact same
-    //amounts of checkpoints after the mint was accumulated, then you could know the range of blocks that the mint originated from.
-    if (nSecurityLevel < 100) {
-        //add some randomness to the user's selection so that it is not always the same
-        nSecurityLevel += CBigNum::randBignum(10).getint();
+    state.SetNull();
+    state.bnPubcoin = coin.getValue();
+    state.denom = coin.getDenomination();
+    state.nHeightMint = nHeightMintAdded;
+    state.hashBlockMint = hashBlock;
+    state.nAccStartHeight = nAccStartHeight;
+    state.bnAccStartValue = bnAccValue;
+    state.nMintsBeforeStart = nMintsBeforeStart;
+
+    CAccumulatorWitnessSnapshot snapshot;
+    snapshot.nHeight = nAccStartHeight;
+    snapshot.hashBlockPrev = chainActive[nAccStartHeight - 1]->GetBlockHash();
+    snapshot.bnWitness = bnAccValue;
+    state.vSnapshots.push_back(snapshot);
+    state.snapshotLatest = snapshot;
 
-        //security level 100 represents adding all available coins that have been accumulated - user did not select this
-        if (nSecurityLevel >= 100)
-            nSecurityLevel = 99;
+    return true;
+}
+
+static bool IsSnapshotInChain(const CAccumulatorWitnessSnapshot& snapshot)
+{
+    CBlockIndex* pindexPrev = chainActive[snapshot.nHeight - 1];
+    return pindexPrev && pindexPrev->GetBlockHash() == snapshot.hashBlockPrev;
+}
+
+//Drop the parts of a witness state that were built from blocks that are no longer in the active chain
+static void RewindAccumulatorWitnessState(const PublicCoin& coin, CAccumulatorWitnessState& state)
+{
+    if (state.bnPubcoin != coin.getValue() || !mapBlockIndex.count(state.hashBlockMint) ||
+        !chainActive.Contains(mapBlockIndex.at(state.hashBlockMint))) {
+        state.SetNull();
+        return;
     }
 
-    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
-    pindex = chainActive[nAccStartHeight];
-    int nChainHeight = chainActive.Height();
-    int nHeightStop = nChainHeight % 10;
-    nHeightStop = nChainHeight - nHeightStop - 20; // at least two checkpoints deep
-    int nCheckpointsAdded = 0;
-    nMintsAdded = 0;
-    while (pindex->nHeight < nHeightStop + 1) {
+    while (!state.vSnapshots.empty() && !IsSnapshotInChain(state.vSnapshots.back()))
+        state.vSnapshots.pop_back();
+
+    if (state.vSnapshots.empty()) {
+        state.SetNull();
+        return;
+    }
+
+    if (state.snapshotLatest.nHeight < state.vSnapshots.back().nHeight || !IsSnapshotInChain(state.snapshotLatest))
+        state.snapshotLatest = state.vSnapshots.back();
+}
+
+void AddBlockToWitnessSnapshot(const PublicCoin& coin, bool fMintBlock, const list<PublicCoin>& listPubcoins,
+    const uint256& hashBlock, CAccumulatorWitnessSnapshot& snapshot)
+{
+    const AccumulatorAndProofParams& accParams = Params().Zerocoin_Params()->accumulatorParams;
+    for (const PublicCoin& pubcoin : listPubcoins) {
+        //the coin being witnessed is not part of its own witness
+        if (fMintBlock && pubcoin.getValue() == coin.getValue())
+            continue;
+
+        snapshot.bnWitness = accParams.accumulatorPowMod(snapshot.bnWitness, pubcoin.getValue());
+        ++snapshot.nMintsAdded;
+    }
+
+    snapshot.nHeight++;
+    snapshot.hashBlockPrev = hashBlock;
+}
+
+//Continue the witness walk from a snapshot, adding the pubcoins of every block of the denomination being spent.
+//With pbnAccValue the walk ends where a spend of the given security level stops and returns the accumulator value
+//that matches the witness. Without it the snapshot is moved up to (the top of) nHeightStop and, if pvSnapshots is
+//given, a copy is kept every WITNESS_SNAPSHOT_INTERVAL checkpoints.
+static bool WalkAccumulatorWitness(const PublicCoin& coin, int nHeightMint, int nAccStartHeight, CAccumulatorWitnessSnapshot& snapshot,
+    int nSecurityLevel, int nHeightStop, CBigNum* pbnAccValue, std::vector<CAccumulatorWitnessSnapshot>* pvSnapshots)
+{
+    CBlockIndex* pindex = chainActive[snapshot.nHeight];
+    while (pindex && pindex->nHeight < nHeightStop + 1) {
+        int nCheckpointsAdded = snapshot.nCheckpointsAdded;
         if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
             ++nCheckpointsAdded;
 
-        //if a new checkpoint was generated on this block, and we have added the specified amount of checkpointed accumulators,
-        //then initialize the accumulator at this point and break
-        if (!InvalidCheckpointRange(pindex->nHeight) && (pindex->nHeight == nHeightStop || (nSecurityLevel != 100 && nCheckpointsAdded >= nSecurityLevel))) {
+        if (!pbnAccValue) {
+            //leave the snapshot before the checkpoint of nHeightStop is counted so it can be resumed later
+            if (pindex->nHeight == nHeightStop)
+                break;
+        } else if (!InvalidCheckpointRange(pindex->nHeight) && (pindex->nHeight == nHeightStop || (nSecurityLevel != 100 && nCheckpointsAdded >= nSecurityLevel))) {
+            //if a new checkpoint was generated on this block, and we have added the specified amount of checkpointed accumulators,
+            //then initialize the accumulator at this point and break
             uint32_t nChecksum = ParseChecksum(chainActive[pindex->nHeight + 10]->nAccumulatorCheckpoint, coin.getDenomination());
             CBigNum bnAccValue = 0;
             if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
                 LogPrintf("%s : failed to find checksum in database for accumulator\n", __func__);
                 return false;
             }
-            accumulator.setValue(bnAccValue);
-            break;
+            *pbnAccValue = bnAccValue;
+            snapshot.nCheckpointsAdded = nCheckpointsAdded;
+            return true;
         }
 
         // if this block contains mints of the denomination that is being spent, then add them to the witness
-        if (pindex->MintedDenomination(coin.getDenomination())) {
-            //grab mints from this block
-            CBlock block;
-            if(!ReadBlockFromDisk(block, pindex)) {
-                LogPrintf("%s: failed to read block from disk while adding pubcoins to witness\n", __func__);
-                return false;
-            }
+        list<PublicCoin> listPubcoins;
+        if (pindex->MintedDenomination(coin.getDenomination()) && !BlockIndexToPubcoinList(pindex, listPubcoins, coin.getDenomination())) {
+            LogPrintf("%s: failed to get zerocoin mintlist from block %d\n", __func__, pindex->nHeight);
+            return false;
+        }
+        AddBlockToWitnessSnapshot(coin, pindex->nHeight == nHeightMint, listPubcoins, pindex->GetBlockHash(), snapshot);
+        snapshot.nCheckpointsAdded = nCheckpointsAdded;
 
-            list<PublicCoin> listPubcoins;
-            if(!BlockToPubcoinList(block, listPubcoins)) {
-                LogPrintf("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
-                return false;
-            }
+        if (pvSnapshots && snapshot.nCheckpointsAdded < 100 &&
+            snapshot.nCheckpointsAdded >= pvSnapshots->back().nCheckpointsAdded + WITNESS_SNAPSHOT_INTERVAL)
+            pvSnapshots->push_back(snapshot);
 
-            //add the mints to the witness
-            for (const PublicCoin pubcoin : listPubcoins) {
-                if (pubcoin.getDenomination() != coin.getDenomination())
-                    continue;
+        pindex = chainActive[pindex->nHeight + 1];
+    }
 
-                if (pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                    continue;
+    return true;
+}
 
-                witness.addRawValue(pubcoin.getValue());
-                ++nMintsAdded;
-            }
-        }
+//The last block whose checkpoint a witness can be paired with: at least two checkpoints deep
+static int GetWitnessStopHeight()
+{
+    int nChainHeight = chainActive.Height();
+    return nChainHeight - (nChainHeight % 10) - 20;
+}
 
-        pindex = chainActive[pindex->nHeight + 1];
+bool UpdateAccumulatorWitnessState(const PublicCoin& coin, CAccumulatorWitnessState& state)
+{
+    AssertLockHeld(cs_main);
+
+    if (!state.IsNull())
+        RewindAccumulatorWitnessState(coin, state);
+    if (state.IsNull() && !InitAccumulatorWitnessState(coin, state))
+        return false;
+
+    int nHeightStop = GetWitnessStopHeight();
+    if (state.snapshotLatest.nHeight >= nHeightStop)
+        return true;
+
+    return WalkAccumulatorWitness(coin, state.nHeightMint, state.nAccStartHeight, state.snapshotLatest, 100, nHeightStop, NULL, &state.vSnapshots);
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CAccumulatorWitnessState* pstate)
+{
+    AssertLockHeld(cs_main);
+
+    //without a stored state the walk starts from scratch at the checkpoint before the mint
+    CAccumulatorWitnessState stateTemp;
+    CAccumulatorWitnessState& state = pstate ? *pstate : stateTemp;
+    if (!state.IsNull())
+        RewindAccumulatorWitnessState(coin, state);
+    if (state.IsNull() && !InitAccumulatorWitnessState(coin, state))
+        return false;
+
+    //security level: this is an important prevention of tracing the coins via timing. Security level represents how many checkpoints
+    //of accumulated coins are added *beyond* the checkpoint that the mint being spent was added too. If each spend added the exact same
+    //amounts of checkpoints after the mint was accumulated, then you could know the range of blocks that the mint originated from.
+    if (nSecurityLevel < 100) {
+        //add some randomness to the user's selection so that it is not always the same
+        nSecurityLevel += CBigNum::randBignum(10).getint();
+
+        //security level 100 represents adding all available coins that have been accumulated - user did not select this
+        if (nSecurityLevel >= 100)
+            nSecurityLevel = 99;
     }
 
+    //resume from the furthest snapshot that the walk for this security level passes through: one that is not past the
+    //stop height and, unless all coins are added, has seen fewer checkpoints than the security level asks for
+    int nHeightStop = GetWitnessStopHeight();
+    std::vector<CAccumulatorWitnessSnapshot> vCandidates = state.vSnapshots;
+    vCandidates.push_back(state.snapshotLatest);
+    CAccumulatorWitnessSnapshot snapshot = state.vSnapshots.front();
+    for (const CAccumulatorWitnessSnapshot& candidate : vCandidates) {
+        if (candidate.nHeight > snapshot.nHeight && candidate.nHeight <= nHeightStop &&
+            (nSecurityLevel == 100 || candidate.nCheckpointsAdded < nSecurityLevel))
+            snapshot = candidate;
+    }
+
+    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
+    CBigNum bnAccValue = state.bnAccStartValue;
+    if (!WalkAccumulatorWitness(coin, state.nHeightMint, state.nAccStartHeight, snapshot, nSecurityLevel, nHeightStop, &bnAccValue, NULL))
+        return false;
+
+    accumulator.setValue(bnAccValue);
+    witness.resetValue(Accumulator(Params().Zerocoin_Params(), coin.getDenomination(), snapshot.bnWitness), coin);
+
+    nMintsAdded = snapshot.nMintsAdded;
     if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
         strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
         LogPrintf("%s : %s\n", __func__, strError);
         return false;
     }
 
-    // calculate how many mints of this denomination existed in the accumulator we initialized
-    int nZerocoinStartHeight = GetZerocoinStartHeight();
-    pindex = chainActive[nZerocoinStartHeight];
-    while (pindex->nHeight < nAccStartHeight) {
-        nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), coin.getDenomination());
-        pindex = chainActive[pindex->nHeight + 1];
-    }
+    nMintsAdded += state.nMintsBeforeStart;
 
     LogPrint("zero","%s : %d mints added to witness\n", __func__, nMintsAdded);
     return true;
-}
\ No newline at end of file
+}
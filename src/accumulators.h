@@ -11,7 +11,116 @@
 #include "primitives/zerocoin.h"
 #include "uint256.h"
 
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError);
+#include <list>
+
+class CBlockIndex;
+
+/** Checkpoints between two witness snapshots kept by CAccumulatorWitnessState */
+static const int WITNESS_SNAPSHOT_INTERVAL = 10;
+
+/**
+ * One position of the witness walk done by GenerateAccumulatorWitness: the
+ * witness holds every pubcoin of its denomination minted from the start
+ * height up to, but not including, nHeight.
+ */
+class CAccumulatorWitnessSnapshot
+{
+public:
+    int nHeight;
+    uint256 hashBlockPrev; //! hash of block nHeight - 1, used to detect reorgs
+    int nCheckpointsAdded;
+    int nMintsAdded;
+    CBigNum bnWitness;
+
+    CAccumulatorWitnessSnapshot()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nHeight = 0;
+        hashBlockPrev = 0;
+        nCheckpointsAdded = 0;
+        nMintsAdded = 0;
+        bnWitness = 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nHeight);
+        READWRITE(hashBlockPrev);
+        READWRITE(nCheckpointsAdded);
+        READWRITE(nMintsAdded);
+        READWRITE(bnWitness);
+    }
+};
+
+/**
+ * Witness of one of the wallet's mints, kept up to date as blocks connect so
+ * that a spend only has to add the pubcoins minted since the last update.
+ * Besides the furthest position, a snapshot is kept every
+ * WITNESS_SNAPSHOT_INTERVAL checkpoints so spends with a security level
+ * below 100 can resume close to where their walk stops.
+ */
+class CAccumulatorWitnessState
+{
+public:
+    CBigNum bnPubcoin;
+    libzerocoin::CoinDenomination denom;
+    int nHeightMint;
+    uint256 hashBlockMint;
+    int nAccStartHeight;
+    CBigNum bnAccStartValue;  //! accumulator value the witness walk starts from
+    int nMintsBeforeStart;    //! mints of this denomination accumulated before nAccStartHeight
+    std::vector<CAccumulatorWitnessSnapshot> vSnapshots; //! ascending, vSnapshots[0] is the start of the walk
+    CAccumulatorWitnessSnapshot snapshotLatest;
+
+    CAccumulatorWitnessState()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        bnPubcoin = 0;
+        denom = libzerocoin::ZQ_ERROR;
+        nHeightMint = 0;
+        hashBlockMint = 0;
+        nAccStartHeight = 0;
+        bnAccStartValue = 0;
+        nMintsBeforeStart = 0;
+        vSnapshots.clear();
+        snapshotLatest.SetNull();
+    }
+
+    bool IsNull() const { return vSnapshots.empty(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(bnPubcoin);
+        READWRITE(denom);
+        READWRITE(nHeightMint);
+        READWRITE(hashBlockMint);
+        READWRITE(nAccStartHeight);
+        READWRITE(bnAccStartValue);
+        READWRITE(nMintsBeforeStart);
+        READWRITE(vSnapshots);
+        READWRITE(snapshotLatest);
+    }
+};
+
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CAccumulatorWitnessState* pstate = NULL);
+bool UpdateAccumulatorWitnessState(const libzerocoin::PublicCoin& coin, CAccumulatorWitnessState& state);
+/** Advance a witness snapshot past block snapshot.nHeight, whose pubcoins of the coin's denomination are listPubcoins */
+void AddBlockToWitnessSnapshot(const libzerocoin::PublicCoin& coin, bool fMintBlock, const std::list<libzerocoin::PublicCoin>& listPubcoins,
+    const uint256& hashBlock, CAccumulatorWitnessSnapshot& snapshot);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
@@ -14,6 +14,9 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -100,6 +103,145 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/** Number of coins of each zerocoin denomination, kept in a fixed array indexed by
+ * the position of the denomination in zerocoinDenomList. Serializes exactly like the
+ * std::map<CoinDenomination, int64_t> it replaces.
+ */
+class CZerocoinSupply
+{
+private:
+    int64_t nSupply[libzerocoin::ZEROCOIN_DENOM_COUNT];
+
+public:
+    CZerocoinSupply()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        std::fill(nSupply, nSupply + libzerocoin::ZEROCOIN_DENOM_COUNT, 0);
+    }
+
+    int64_t& at(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex < 0)
+            throw std::out_of_range("CZerocoinSupply::at() : invalid denomination");
+        return nSupply[nIndex];
+    }
+
+    const int64_t& at(libzerocoin::CoinDenomination denom) const
+    {
+        return const_cast<CZerocoinSupply*>(this)->at(denom);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(libzerocoin::ZEROCOIN_DENOM_COUNT) + libzerocoin::ZEROCOIN_DENOM_COUNT * (sizeof(int) + sizeof(int64_t));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, libzerocoin::ZEROCOIN_DENOM_COUNT);
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++) {
+            ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+            ::Serialize(s, nSupply[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        SetNull();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            libzerocoin::CoinDenomination denom;
+            int64_t nValue;
+            ::Unserialize(s, denom, nType, nVersion);
+            ::Unserialize(s, nValue, nType, nVersion);
+            int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (nIndex >= 0)
+                nSupply[nIndex] = nValue;
+        }
+    }
+};
+
+/** Number of mints of each zerocoin denomination in a block. Serializes like the
+ * std::vector<CoinDenomination> it replaces, with one entry per mint.
+ */
+class CZerocoinMintCounts
+{
+private:
+    // a mint output takes a few hundred bytes, so a block can never hold 65535 of them
+    uint16_t nMints[libzerocoin::ZEROCOIN_DENOM_COUNT];
+
+public:
+    CZerocoinMintCounts()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        std::fill(nMints, nMints + libzerocoin::ZEROCOIN_DENOM_COUNT, 0);
+    }
+
+    bool IsNull() const
+    {
+        return GetTotal() == 0;
+    }
+
+    void Add(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex >= 0 && nMints[nIndex] < std::numeric_limits<uint16_t>::max())
+            nMints[nIndex]++;
+    }
+
+    int Count(libzerocoin::CoinDenomination denom) const
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return nIndex < 0 ? 0 : nMints[nIndex];
+    }
+
+    int GetTotal() const
+    {
+        int nTotal = 0;
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++)
+            nTotal += nMints[i];
+        return nTotal;
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(GetTotal()) + GetTotal() * sizeof(int);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, GetTotal());
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++) {
+            for (int j = 0; j < nMints[i]; j++)
+                ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        SetNull();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            libzerocoin::CoinDenomination denom;
+            ::Unserialize(s, denom, nType, nVersion);
+            Add(denom);
+        }
+    }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -179,8 +321,8 @@ public:
     uint32_t nSequenceId;
     
     //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    CZerocoinSupply zerocoinSupply;
+    CZerocoinMintCounts mintsInBlock;
     
     void SetNull()
     {
@@ -212,10 +354,8 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        zerocoinSupply.SetNull();
+        mintsInBlock.SetNull();
     }
 
     CBlockIndex()
@@ -293,14 +433,14 @@ public:
     {
         int64_t nTotal = 0;
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * mapZerocoinSupply.at(denom);
+            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * zerocoinSupply.at(denom);
         }
         return nTotal;
     }
 
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        return mintsInBlock.Count(denom) > 0;
     }
 
     uint256 GetBlockHash() const
@@ -432,7 +572,7 @@ public:
         hashNext = uint256();
     }
 
-    explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex)
+    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
     }
@@ -479,8 +619,8 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
-            READWRITE(mapZerocoinSupply);
-            READWRITE(vMintDenominationsInBlock);
+            READWRITE(zerocoinSupply);
+            READWRITE(mintsInBlock);
         }
 
     }
@@ -43,6 +43,11 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#define USE_EPOLL 1
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
 #endif
 
 #ifdef WIN32
@@ -92,7 +97,7 @@ size_t strnlen_int(const char* start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s)
 {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
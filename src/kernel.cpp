@@ -8,6 +8,8 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "checkqueue.h"
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -63,7 +65,7 @@ static int64_t GetStakeModifierSelectionIntervalSection(int nSection)
 }
 
 // Get stake modifier selection interval (in seconds)
-static int64_t GetStakeModifierSelectionInterval()
+int64_t GetStakeModifierSelectionInterval()
 {
     int64_t nSelectionInterval = 0;
     for (int nSection = 0; nSection < 64; nSection++) {
@@ -243,12 +245,12 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime)
 {
+    if (stakeModifierIndex.GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime))
+        return true;
+
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
-        return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -273,6 +275,90 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
     return true;
 }
 
+CStakeModifierIndex stakeModifierIndex;
+
+void CStakeModifierIndex::ConnectBlock(const CBlockIndex* pindex)
+{
+    int nHeight = vEntries.size();
+    assert(pindex->nHeight == nHeight);
+
+    CEntry entry;
+    entry.pindex = pindex;
+    entry.nStakeModifier = 0;
+    entry.nHeightModifier = -1;
+    entry.nHeightResolvedFloor = nHeight;
+    vEntries.push_back(entry);
+    int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
+    queuePending.push(std::make_pair(pindex->GetBlockTime() + nSelectionInterval, nHeight));
+
+    if (!pindex->GeneratedStakeModifier())
+        return;
+
+    //this block provides the modifier of every earlier block whose selection interval it reaches
+    while (!queuePending.empty() && queuePending.top().first <= pindex->GetBlockTime()) {
+        int nHeightFrom = queuePending.top().second;
+        int64_t nTimeTarget = queuePending.top().first;
+        queuePending.pop();
+
+        //skip what is left in the queue from disconnected blocks or entries that were already provided for
+        if (nHeightFrom >= nHeight || vEntries[nHeightFrom].nHeightModifier != -1 ||
+            vEntries[nHeightFrom].pindex->GetBlockTime() + nSelectionInterval != nTimeTarget)
+            continue;
+
+        vEntries[nHeightFrom].nStakeModifier = pindex->nStakeModifier;
+        vEntries[nHeightFrom].nHeightModifier = nHeight;
+        vEntries[nHeight].nHeightResolvedFloor = std::min(vEntries[nHeight].nHeightResolvedFloor, nHeightFrom);
+    }
+}
+
+void CStakeModifierIndex::DisconnectBlock()
+{
+    int nHeight = vEntries.size() - 1;
+    int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
+    for (int i = vEntries[nHeight].nHeightResolvedFloor; i < nHeight; i++) {
+        if (vEntries[i].nHeightModifier != nHeight)
+            continue;
+
+        vEntries[i].nStakeModifier = 0;
+        vEntries[i].nHeightModifier = -1;
+        queuePending.push(std::make_pair(vEntries[i].pindex->GetBlockTime() + nSelectionInterval, i));
+    }
+    vEntries.pop_back();
+}
+
+void CStakeModifierIndex::SetTip(const CBlockIndex* pindexNew)
+{
+    LOCK(cs);
+    while (!vEntries.empty() && (!pindexNew || pindexNew->GetAncestor(vEntries.size() - 1) != vEntries.back().pindex))
+        DisconnectBlock();
+
+    if (!pindexNew)
+        return;
+
+    std::vector<const CBlockIndex*> vConnect;
+    for (const CBlockIndex* pindex = pindexNew; pindex && pindex->nHeight >= (int)vEntries.size(); pindex = pindex->pprev)
+        vConnect.push_back(pindex);
+    for (std::vector<const CBlockIndex*>::reverse_iterator it = vConnect.rbegin(); it != vConnect.rend(); ++it)
+        ConnectBlock(*it);
+}
+
+bool CStakeModifierIndex::GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime) const
+{
+    LOCK(cs);
+    //only answer for the chain the walk in GetKernelStakeModifier would follow
+    if (vEntries.empty() || vEntries.back().pindex != chainActive.Tip())
+        return false;
+
+    int nHeight = pindexFrom->nHeight;
+    if (nHeight < 0 || nHeight >= (int)vEntries.size() || vEntries[nHeight].pindex != pindexFrom || vEntries[nHeight].nHeightModifier == -1)
+        return false;
+
+    nStakeModifier = vEntries[nHeight].nStakeModifier;
+    nStakeModifierHeight = vEntries[nHeight].nHeightModifier;
+    nStakeModifierTime = vEntries[nStakeModifierHeight].pindex->GetBlockTime();
+    return true;
+}
+
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom)
 {
     //Umbra will hash in the transaction hash and the index number in order to make sure each hash is unique
@@ -291,11 +377,10 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
 }
 
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
     //assign new variables to make it easier to read
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
+    unsigned int nTimeBlockFrom = pindexFrom->GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
@@ -311,19 +396,18 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
+    if (!GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime)) {
         LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
         return false;
     }
 
-    //create data stream once instead of repeating it in the loop
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
+    //feed the constant part of the kernel to the hasher once instead of repeating it in the loop
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout, nValueIn, nBits);
 
     //if wallet is simply checking to make sure a hash is valid
     if (fCheck) {
-        hashProofOfStake = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-        return stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay);
+        hashProofOfStake = kernel.GetHash(nTimeTx);
+        return kernel.CheckHash(hashProofOfStake);
     }
 
     bool fSuccess = false;
@@ -338,10 +422,10 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
 
         //hash this iteration
         nTryTime = nTimeTx + nHashDrift - i;
-        hashProofOfStake = stakeHash(nTryTime, ss, prevout.n, prevout.hash, nTimeBlockFrom);
+        hashProofOfStake = kernel.GetHash(nTryTime);
 
         // if stake hash does not meet the target then continue to next iteration
-        if (!stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay))
+        if (!kernel.CheckHash(hashProofOfStake))
             continue;
 
         fSuccess = true; // if we make it this far then we have successfully created a stake hash
@@ -351,8 +435,8 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
             LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(), nStakeModifierHeight,
                 DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
+                pindexFrom->nHeight,
+                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexFrom->GetBlockTime()).c_str());
             LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=%s nTimeBlockFrom=%u prevoutHash=%s nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
                 "0.3",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(),
@@ -367,7 +451,199 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     return fSuccess;
 }
 
+CStakeKernel::CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout, int64_t nValueIn, unsigned int nBits)
+{
+    //same preimage as stakeHash() without the transaction time
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << nTimeBlockFrom << prevout.n << prevout.hash;
+    hasherPrefix.Write((const unsigned char*)&ss[0], ss.size());
+
+    //same target as stakeTargetHit()
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    bnTarget = (uint256(nValueIn) / 100) * bnTargetPerCoinDay;
+}
+
+uint256 CStakeKernel::GetHash(unsigned int nTimeTx) const
+{
+    //serialized little endian like the CDataStream in stakeHash(), whatever the host byte order
+    unsigned char vchTimeTx[4];
+    WriteLE32(vchTimeTx, nTimeTx);
+    CHash256 hasher(hasherPrefix);
+    uint256 hashProofOfStake;
+    hasher.Write(vchTimeTx, sizeof(vchTimeTx)).Finalize((unsigned char*)&hashProofOfStake);
+    return hashProofOfStake;
+}
+
+bool CStakeKernel::Search(unsigned int& nTimeTx, unsigned int nHashDrift, uint256& hashProofOfStake) const
+{
+    for (unsigned int i = 0; i < nHashDrift; i++) {
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        uint256 hash = GetHash(nTryTime);
+        if (CheckHash(hash)) {
+            nTimeTx = nTryTime;
+            hashProofOfStake = hash;
+            return true;
+        }
+    }
+    return false;
+}
+
+//result of searching the time window of one candidate
+struct CStakeKernelResult {
+    bool fFound;
+    unsigned int nTimeTx;
+    uint256 hashProofOfStake;
+
+    CStakeKernelResult() : fFound(false), nTimeTx(0) {}
+};
+
+/**
+ * Closure representing the search of the time window of one stake candidate.
+ * It fails once a kernel is found or a new block arrives, which makes the
+ * check queue skip the candidates that have not been searched yet. Everything
+ * it needs from the chain is captured by the caller under cs_main.
+ */
+class CStakeKernelCheck
+{
+private:
+    const CStakeKernel* pkernel;
+    CStakeKernelResult* presult;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    int nHeightStart;
+
+public:
+    CStakeKernelCheck() : pkernel(NULL), presult(NULL), nTimeTx(0), nHashDrift(0), nHeightStart(0) {}
+    CStakeKernelCheck(const CStakeKernel* pkernelIn, CStakeKernelResult* presultIn, unsigned int nTimeTxIn, unsigned int nHashDriftIn, int nHeightStartIn) :
+        pkernel(pkernelIn), presult(presultIn), nTimeTx(nTimeTxIn), nHashDrift(nHashDriftIn), nHeightStart(nHeightStartIn) {}
+
+    bool operator()()
+    {
+        //new block came in, move on; the tip is only looked at while cs_main is free, so the search never waits on validation
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if (lockMain && chainActive.Height() != nHeightStart)
+                return false;
+        }
+
+        presult->nTimeTx = nTimeTx;
+        presult->fFound = pkernel->Search(presult->nTimeTx, nHashDrift, presult->hashProofOfStake);
+        return !presult->fFound;
+    }
+
+    void swap(CStakeKernelCheck& check)
+    {
+        std::swap(pkernel, check.pkernel);
+        std::swap(presult, check.presult);
+        std::swap(nTimeTx, check.nTimeTx);
+        std::swap(nHashDrift, check.nHashDrift);
+        std::swap(nHeightStart, check.nHeightStart);
+    }
+};
+
+static CCheckQueue<CStakeKernelCheck> stakekernelqueue(32);
+//! Only one master may drive stakekernelqueue at a time
+static boost::mutex cs_stakekernelqueue;
+
+void ThreadStakeKernelSearch()
+{
+    RenameThread("umbra-stakesrch");
+    stakekernelqueue.Thread();
+}
+
+bool SearchStakeKernel(unsigned int nBits, const std::vector<CStakeCandidate>& vCandidates, unsigned int nHashDrift, int& nCandidate, unsigned int& nTimeTx, uint256& hashProofOfStake)
+{
+    int nHeightStart;
+    std::vector<CStakeKernel> vKernels;
+    std::vector<int> vCandidateIndex;
+    vKernels.reserve(vCandidates.size());
+    vCandidateIndex.reserve(vCandidates.size());
+
+    {
+        //the kernels are built from the chain state under cs_main, the worker threads only hash
+        LOCK(cs_main);
+        nHeightStart = chainActive.Height();
+        for (unsigned int i = 0; i < vCandidates.size(); i++) {
+            const CStakeCandidate& candidate = vCandidates[i];
+            unsigned int nTimeBlockFrom = candidate.pindexFrom->GetBlockTime();
+            if (nTimeTx < nTimeBlockFrom || nTimeBlockFrom + nStakeMinAge > nTimeTx)
+                continue;
+
+            uint64_t nStakeModifier = 0;
+            int nStakeModifierHeight = 0;
+            int64_t nStakeModifierTime = 0;
+            if (!GetKernelStakeModifier(candidate.pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime))
+                continue;
+
+            vKernels.push_back(CStakeKernel(nStakeModifier, nTimeBlockFrom, candidate.prevout, candidate.nValue, nBits));
+            vCandidateIndex.push_back(i);
+        }
+    }
+
+    std::vector<CStakeKernelResult> vResults(vKernels.size());
+    std::vector<CStakeKernelCheck> vChecks;
+    vChecks.reserve(vKernels.size());
+    for (unsigned int i = 0; i < vKernels.size(); i++)
+        vChecks.push_back(CStakeKernelCheck(&vKernels[i], &vResults[i], nTimeTx, nHashDrift, nHeightStart));
+
+    if (nScriptCheckThreads) {
+        boost::unique_lock<boost::mutex> lock(cs_stakekernelqueue);
+        CCheckQueueControl<CStakeKernelCheck> control(&stakekernelqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CStakeKernelCheck& check : vChecks) {
+            if (!check())
+                break;
+        }
+    }
+
+    mapHashedBlocks.clear();
+    mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+
+    //several threads may have found a kernel, prefer the earliest candidate
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        if (!vResults[i].fFound)
+            continue;
+
+        nCandidate = vCandidateIndex[i];
+        nTimeTx = vResults[i].nTimeTx;
+        hashProofOfStake = vResults[i].hashProofOfStake;
+        return true;
+    }
+
+    return false;
+}
+
 // Check kernel hash target and coinstake signature
+// Find the output staked by a coinstake and the block that created it. The
+// output is normally still unspent in the chain state, which holds both its
+// value and height, so neither the transaction nor the block has to be read.
+static bool GetStakedOutput(const COutPoint& prevout, CTxOut& txPrevOut, const CBlockIndex*& pindexFrom)
+{
+    const CCoins* coins = pcoinsTip->AccessCoins(prevout.hash);
+    if (coins && coins->IsAvailable(prevout.n) && chainActive[coins->nHeight]) {
+        txPrevOut = coins->vout[prevout.n];
+        pindexFrom = chainActive[coins->nHeight];
+        return true;
+    }
+
+    // Blocks on a fork may stake an output the active chain has spent since
+    uint256 hashBlock;
+    CTransaction txPrev;
+    if (!GetTransaction(prevout.hash, txPrev, hashBlock, true) || prevout.n >= txPrev.vout.size())
+        return error("%s : INFO: read txPrev failed", __func__);
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end())
+        return error("%s : block %s not found", __func__, hashBlock.ToString());
+
+    txPrevOut = txPrev.vout[prevout.n];
+    pindexFrom = mi->second;
+    return true;
+}
+
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 {
     const CTransaction tx = block.vtx[1];
@@ -377,31 +653,18 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-    uint256 hashBlock;
-    CTransaction txPrev;
-    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-        return error("CheckProofOfStake() : INFO: read txPrev failed");
+    CTxOut txPrevOut;
+    const CBlockIndex* pindexFrom = NULL;
+    if (!GetStakedOutput(txin.prevout, txPrevOut, pindexFrom))
+        return error("CheckProofOfStake() : INFO: staked output %s not found", txin.prevout.ToString());
 
     //verify signature and script
-    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+    if (!VerifyScript(txin.scriptSig, txPrevOut.scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
         return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
-    CBlockIndex* pindex = NULL;
-    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
-    if (it != mapBlockIndex.end())
-        pindex = it->second;
-    else
-        return error("CheckProofOfStake() : read block failed");
-
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     unsigned int nInterval = 0;
     unsigned int nTime = block.nTime;
-    if (!CheckStakeKernelHash(block.nBits, blockprev, txPrev, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
+    if (!CheckStakeKernelHash(block.nBits, pindexFrom, txPrevOut.nValue, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx.GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str()); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -5,8 +5,11 @@
 #ifndef BITCOIN_KERNEL_H
 #define BITCOIN_KERNEL_H
 
+#include "hash.h"
 #include "main.h"
 
+#include <queue>
+
 
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
 static const unsigned int MODIFIER_INTERVAL = 60;
@@ -18,6 +21,9 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+// Get stake modifier selection interval (in seconds)
+int64_t GetStakeModifierSelectionInterval();
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
@@ -25,7 +31,76 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
 // Sets hashProofOfStake on success return
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+
+// Index from the height of a block in the active chain to the stake modifier a kernel staking an output
+// of that block uses, i.e. the modifier of the first block a selection interval later that generated one.
+// It follows the active chain a block at a time so lookups do not have to walk the chain forward.
+class CStakeModifierIndex
+{
+private:
+    struct CEntry {
+        const CBlockIndex* pindex;
+        uint64_t nStakeModifier;
+        //height of the block whose modifier is used, -1 while no block is far enough ahead yet
+        int nHeightModifier;
+        //lowest height of the entries this block provides the modifier for
+        int nHeightResolvedFloor;
+    };
+
+    mutable CCriticalSection cs;
+    std::vector<CEntry> vEntries;
+    //entries waiting for a modifier, by the earliest block time that can provide it
+    std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int> >, std::greater<std::pair<int64_t, int> > > queuePending;
+
+    void ConnectBlock(const CBlockIndex* pindex);
+    void DisconnectBlock();
+
+public:
+    // Follow the active chain to pindexNew, disconnecting and connecting blocks as needed
+    void SetTip(const CBlockIndex* pindexNew);
+
+    // Look up the kernel stake modifier of a block of the active chain, false if it is not known
+    bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime) const;
+};
+
+extern CStakeModifierIndex stakeModifierIndex;
+
+// Stake kernel of one output: the constant part of the hash preimage (stake modifier, block-from time
+// and prevout) is fed to the hasher once, so sweeping the time window only hashes the timestamp
+class CStakeKernel
+{
+private:
+    CHash256 hasherPrefix;
+    uint256 bnTarget;
+
+public:
+    CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout, int64_t nValueIn, unsigned int nBits);
+
+    uint256 GetHash(unsigned int nTimeTx) const;
+    bool CheckHash(const uint256& hashProofOfStake) const { return hashProofOfStake < bnTarget; }
+
+    // Try the timestamps nTimeTx + nHashDrift down to nTimeTx + 1, set nTimeTx to the first one that hits the target
+    bool Search(unsigned int& nTimeTx, unsigned int nHashDrift, uint256& hashProofOfStake) const;
+};
+
+// Output considered by the stake kernel search
+class CStakeCandidate
+{
+public:
+    COutPoint prevout;
+    int64_t nValue;
+    const CBlockIndex* pindexFrom;
+
+    CStakeCandidate(const COutPoint& prevoutIn, int64_t nValueIn, const CBlockIndex* pindexFromIn) : prevout(prevoutIn), nValue(nValueIn), pindexFrom(pindexFromIn) {}
+};
+
+// Search the time window of every candidate for a stake kernel, spread over the kernel search threads.
+// On success nCandidate is the index of the candidate that was found and nTimeTx the timestamp of the kernel.
+bool SearchStakeKernel(unsigned int nBits, const std::vector<CStakeCandidate>& vCandidates, unsigned int nHashDrift, int& nCandidate, unsigned int& nTimeTx, uint256& hashProofOfStake);
+
+// Run an instance of the stake kernel search thread
+void ThreadStakeKernelSearch();
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
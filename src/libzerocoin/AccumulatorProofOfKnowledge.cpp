@@ -36,9 +36,9 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 	CBigNum r_2 = CBigNum::randBignum(params->accumulatorModulus/4);
 	CBigNum r_3 = CBigNum::randBignum(params->accumulatorModulus/4);
 
-	this->C_e = g_n.pow_mod(e, params->accumulatorModulus) * h_n.pow_mod(r_1, params->accumulatorModulus);
-	this->C_u = witness.getValue() * h_n.pow_mod(r_2, params->accumulatorModulus);
-	this->C_r = g_n.pow_mod(r_2, params->accumulatorModulus) * h_n.pow_mod(r_3, params->accumulatorModulus);
+	this->C_e = params->qrnPowG(e) * params->qrnPowH(r_1);
+	this->C_u = witness.getValue() * params->qrnPowH(r_2);
+	this->C_r = params->qrnPowG(r_2) * params->qrnPowH(r_3);
 
 	CBigNum r_alpha = CBigNum::randBignum(params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime));
 	if(!(CBigNum::randBignum(CBigNum(3)) % 2)) {
@@ -73,14 +73,14 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 		r_delta = 0-r_delta;
 	}
 
-	this->st_1 = (sg.pow_mod(r_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_2 = (((commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(r_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(r_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_3 = ((sg * commitmentToCoin.getCommitmentValue()).pow_mod(r_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_1 = (params->accumulatorPoKCommitmentGroup.powG(r_alpha) * params->accumulatorPoKCommitmentGroup.powH(r_phi)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_2 = (params->accumulatorPoKCommitmentGroup.powMod(commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus), r_gamma) * params->accumulatorPoKCommitmentGroup.powH(r_psi)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_3 = (params->accumulatorPoKCommitmentGroup.powMod(sg * commitmentToCoin.getCommitmentValue(), r_sigma) * params->accumulatorPoKCommitmentGroup.powH(r_xi)) % params->accumulatorPoKCommitmentGroup.modulus;
 
-	this->t_1 = (h_n.pow_mod(r_zeta, params->accumulatorModulus) * g_n.pow_mod(r_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_2 = (h_n.pow_mod(r_eta, params->accumulatorModulus) * g_n.pow_mod(r_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_3 = (C_u.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	this->t_4 = (C_r.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	this->t_1 = (params->qrnPowH(r_zeta) * params->qrnPowG(r_epsilon)) % params->accumulatorModulus;
+	this->t_2 = (params->qrnPowH(r_eta) * params->qrnPowG(r_alpha)) % params->accumulatorModulus;
+	this->t_3 = (params->accumulatorPowMod(C_u, r_alpha) * params->qrnPowH(-r_beta)) % params->accumulatorModulus;
+	this->t_4 = (params->accumulatorPowMod(C_r, r_alpha) * params->qrnPowH(-r_delta) * params->qrnPowG(-r_beta)) % params->accumulatorModulus;
 
 	CHashWriter hasher(0,0);
 	hasher << *params << sg << sh << g_n << h_n << commitmentToCoin.getCommitmentValue() << C_e << C_u << C_r << st_1 << st_2 << st_3 << t_1 << t_2 << t_3 << t_4;
@@ -116,14 +116,14 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	CBigNum st_1_prime = (params->accumulatorPoKCommitmentGroup.powMod(valueOfCommitmentToCoin, c) * params->accumulatorPoKCommitmentGroup.powG(s_alpha) * params->accumulatorPoKCommitmentGroup.powH(s_phi)) % params->accumulatorPoKCommitmentGroup.modulus;
+	CBigNum st_2_prime = (params->accumulatorPoKCommitmentGroup.powG(c) * params->accumulatorPoKCommitmentGroup.powMod(valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus), s_gamma) * params->accumulatorPoKCommitmentGroup.powH(s_psi)) % params->accumulatorPoKCommitmentGroup.modulus;
+	CBigNum st_3_prime = (params->accumulatorPoKCommitmentGroup.powG(c) * params->accumulatorPoKCommitmentGroup.powMod(sg * valueOfCommitmentToCoin, s_sigma) * params->accumulatorPoKCommitmentGroup.powH(s_xi)) % params->accumulatorPoKCommitmentGroup.modulus;
 
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	CBigNum t_1_prime = (params->accumulatorPowMod(C_r, c) * params->qrnPowH(s_zeta) * params->qrnPowG(s_epsilon)) % params->accumulatorModulus;
+	CBigNum t_2_prime = (params->accumulatorPowMod(C_e, c) * params->qrnPowH(s_eta) * params->qrnPowG(s_alpha)) % params->accumulatorModulus;
+	CBigNum t_3_prime = (params->accumulatorPowMod(a.getValue(), c) * params->accumulatorPowMod(C_u, s_alpha) * params->qrnPowH(-s_beta)) % params->accumulatorModulus;
+	CBigNum t_4_prime = (params->accumulatorPowMod(C_r, s_alpha) * params->qrnPowH(-s_delta) * params->qrnPowG(-s_beta)) % params->accumulatorModulus;
 
 	bool result = false;
 
@@ -15,6 +15,28 @@
 
 namespace libzerocoin {
 
+/**
+ * Shared Montgomery context for a group modulus together with fixed-base
+ * tables for its two generators.
+ */
+class GroupPrecomputation {
+public:
+	GroupPrecomputation(const CBigNum& g, const CBigNum& h, const CBigNum& modulus, unsigned int nBits):
+		mont(new CBigNumMont(modulus)), gTable(g, mont, nBits), hTable(h, mont, nBits) {}
+
+	boost::shared_ptr<const CBigNumMont> mont;
+	CBigNumFixedBase gTable;
+	CBigNumFixedBase hTable;
+};
+
+static boost::shared_ptr<const GroupPrecomputation> BuildPrecomputation(const CBigNum& g, const CBigNum& h,
+        const CBigNum& modulus, unsigned int nBits) {
+	if (modulus <= CBigNum(1)) {
+		throw std::runtime_error("Group parameters are not initialized");
+	}
+	return boost::shared_ptr<const GroupPrecomputation>(new GroupPrecomputation(g, h, modulus, nBits));
+}
+
 ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	this->zkp_hash_len = securityLevel;
 	this->zkp_iterations = securityLevel;
@@ -25,6 +47,12 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	// Generate the parameters
 	CalculateParams(*this, N, ZEROCOIN_PROTOCOL_VERSION, securityLevel);
 
+	// The parameters are final from here on, so build the tables once; every
+	// later exponentiation only reads them and needs no lock
+	this->accumulatorParams.precompute();
+	this->coinCommitmentGroup.precompute();
+	this->serialNumberSoKCommitmentGroup.precompute();
+
 	this->accumulatorParams.initialized = true;
 	this->initialized = true;
 }
@@ -41,7 +69,68 @@ CBigNum IntegerGroupParams::randomElement() const {
 	// The generator of the group raised
 	// to a random number less than the order of the group
 	// provides us with a uniformly distributed random number.
-	return this->g.pow_mod(CBigNum::randBignum(this->groupOrder),this->modulus);
+	return this->powG(CBigNum::randBignum(this->groupOrder));
+}
+
+void IntegerGroupParams::precompute() {
+	// Exponents are normally reduced mod the group order, but proofs also
+	// raise the generators to values around the size of the modulus.
+	unsigned int nBits = std::max(this->modulus.bitSize(), this->groupOrder.bitSize());
+	this->precomputation = BuildPrecomputation(this->g, this->h, this->modulus, nBits);
+}
+
+CBigNum IntegerGroupParams::powG(const CBigNum& e) const {
+	if (!this->precomputation) {
+		return this->g.pow_mod(e, this->modulus);
+	}
+	return this->precomputation->gTable.pow(e);
+}
+
+CBigNum IntegerGroupParams::powH(const CBigNum& e) const {
+	if (!this->precomputation) {
+		return this->h.pow_mod(e, this->modulus);
+	}
+	return this->precomputation->hTable.pow(e);
+}
+
+CBigNum IntegerGroupParams::powGH(const CBigNum& a, const CBigNum& b) const {
+	return powG(a).mul_mod(powH(b), this->modulus);
+}
+
+CBigNum IntegerGroupParams::powMod(const CBigNum& base, const CBigNum& e) const {
+	if (!this->precomputation) {
+		return base.pow_mod(e, this->modulus);
+	}
+	return this->precomputation->mont->pow_mod(base, e);
+}
+
+void AccumulatorAndProofParams::precompute() {
+	this->accumulatorPoKCommitmentGroup.precompute();
+	// The QRN group carries no modulus of its own, its tables live here
+	this->qrnPrecomputation = BuildPrecomputation(this->accumulatorQRNCommitmentGroup.g,
+	                                              this->accumulatorQRNCommitmentGroup.h, this->accumulatorModulus,
+	                                              this->accumulatorModulus.bitSize());
+}
+
+CBigNum AccumulatorAndProofParams::accumulatorPowMod(const CBigNum& base, const CBigNum& e) const {
+	if (!this->qrnPrecomputation) {
+		return base.pow_mod(e, this->accumulatorModulus);
+	}
+	return this->qrnPrecomputation->mont->pow_mod(base, e);
+}
+
+CBigNum AccumulatorAndProofParams::qrnPowG(const CBigNum& e) const {
+	if (!this->qrnPrecomputation) {
+		return this->accumulatorQRNCommitmentGroup.g.pow_mod(e, this->accumulatorModulus);
+	}
+	return this->qrnPrecomputation->gTable.pow(e);
+}
+
+CBigNum AccumulatorAndProofParams::qrnPowH(const CBigNum& e) const {
+	if (!this->qrnPrecomputation) {
+		return this->accumulatorQRNCommitmentGroup.h.pow_mod(e, this->accumulatorModulus);
+	}
+	return this->qrnPrecomputation->hTable.pow(e);
 }
 
 } /* namespace libzerocoin */
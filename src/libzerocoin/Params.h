@@ -18,6 +18,8 @@
 
 namespace libzerocoin {
 
+class GroupPrecomputation;
+
 class IntegerGroupParams {
 public:
 	/** @brief Integer group class, default constructor
@@ -31,6 +33,37 @@ public:
 	 * @return a random element in the group.
 	 */
 	CBigNum randomElement() const;
+
+	/**
+	 * Computes g^e mod modulus using a precomputed table for g.
+	 * @param e the exponent, may be negative
+	 */
+	CBigNum powG(const CBigNum& e) const;
+
+	/**
+	 * Computes h^e mod modulus using a precomputed table for h.
+	 * @param e the exponent, may be negative
+	 */
+	CBigNum powH(const CBigNum& e) const;
+
+	/**
+	 * Computes the Pedersen commitment g^a * h^b mod modulus.
+	 */
+	CBigNum powGH(const CBigNum& a, const CBigNum& b) const;
+
+	/**
+	 * Computes base^e mod modulus reusing the group's Montgomery context.
+	 */
+	CBigNum powMod(const CBigNum& base, const CBigNum& e) const;
+
+	/**
+	 * Builds the Montgomery context and fixed-base tables for the current
+	 * g, h and modulus. Call once the values are final and before the group
+	 * is shared between threads; the pow functions only read the tables.
+	 * Without tables they fall back to plain modular exponentiation.
+	 */
+	void precompute();
+
 	bool initialized;
 
 	/**
@@ -62,7 +95,16 @@ public:
 		    READWRITE(h);
 		    READWRITE(modulus);
 		    READWRITE(groupOrder);
+		    if (ser_action.ForRead())
+		        precomputation.reset();
 	}	
+
+private:
+	/**
+	 * Montgomery context and fixed-base tables, built by precompute().
+	 * Not serialized; immutable once built, so copies share them.
+	 */
+	boost::shared_ptr<const GroupPrecomputation> precomputation;
 };
 
 class AccumulatorAndProofParams {
@@ -138,6 +180,27 @@ public:
 	 * The statistical zero-knowledgeness of the accumulator proof.
 	 */
 	uint32_t k_dprime;
+
+	/**
+	 * Computes base^e mod accumulatorModulus reusing a cached
+	 * Montgomery context.
+	 */
+	CBigNum accumulatorPowMod(const CBigNum& base, const CBigNum& e) const;
+
+	/**
+	 * Computes g^e and h^e mod accumulatorModulus for the QRN commitment
+	 * generators using precomputed tables. The QRN group carries no
+	 * modulus of its own, so these live here rather than on the group.
+	 */
+	CBigNum qrnPowG(const CBigNum& e) const;
+	CBigNum qrnPowH(const CBigNum& e) const;
+
+	/**
+	 * Builds the tables of the accumulator PoK group and of the QRN
+	 * commitment generators, see IntegerGroupParams::precompute().
+	 */
+	void precompute();
+
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 	    READWRITE(initialized);
@@ -149,7 +212,12 @@ public:
 	    READWRITE(maxCoinValue);
 	    READWRITE(k_prime);
 	    READWRITE(k_dprime);
+	    if (ser_action.ForRead())
+	        qrnPrecomputation.reset();
   }
+
+private:
+	boost::shared_ptr<const GroupPrecomputation> qrnPrecomputation;
 };
 
 class ZerocoinParams {
@@ -9,6 +9,8 @@
 #include <stdexcept>
 #include <vector>
 #include <openssl/bn.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
 #include "serialize.h"
 #include "uint256.h"
 #include "version.h"
@@ -21,7 +23,27 @@ public:
 };
 
 
-/** RAII encapsulated BN_CTX (OpenSSL bignum context) */
+/**
+ * Returns the BN_CTX owned by the calling thread, creating it on first use.
+ * Every OpenSSL routine that takes a context brackets its temporaries with
+ * BN_CTX_start/BN_CTX_end, so one context can be shared by all (nested)
+ * bignum operations of a thread and its scratch space is reused instead of
+ * being reallocated for every modular multiplication.
+ */
+inline BN_CTX* GetThreadBN_CTX()
+{
+    static boost::thread_specific_ptr<BN_CTX> ptls(BN_CTX_free);
+    BN_CTX* pctx = ptls.get();
+    if (pctx == NULL) {
+        pctx = BN_CTX_new();
+        if (pctx == NULL)
+            throw bignum_error("GetThreadBN_CTX : BN_CTX_new() returned NULL");
+        ptls.reset(pctx);
+    }
+    return pctx;
+}
+
+/** Scoped handle to the calling thread's pooled BN_CTX (OpenSSL bignum context) */
 class CAutoBN_CTX
 {
 protected:
@@ -31,15 +53,7 @@ protected:
 public:
     CAutoBN_CTX()
     {
-        pctx = BN_CTX_new();
-        if (pctx == NULL)
-            throw bignum_error("CAutoBN_CTX : BN_CTX_new() returned NULL");
-    }
-
-    ~CAutoBN_CTX()
-    {
-        if (pctx != NULL)
-            BN_CTX_free(pctx);
+        pctx = GetThreadBN_CTX();
     }
 
     operator BN_CTX*() { return pctx; }
@@ -787,4 +801,171 @@ inline std::ostream& operator<<(std::ostream &strm, const CBigNum &b) { return s
 
 typedef CBigNum Bignum;
 
+/**
+ * Montgomery context (R^2 mod m, -m^-1 mod 2^w) for one fixed odd modulus.
+ * BN_mod_exp recomputes this for every call; zerocoin exponentiates under a
+ * handful of moduli that never change, so the context is built once and
+ * shared. It is never modified after construction and may be used from
+ * several threads at once.
+ */
+class CBigNumMont
+{
+private:
+    CBigNum modulus;
+    BN_MONT_CTX* pmont;
+
+    CBigNumMont(const CBigNumMont&);
+    CBigNumMont& operator=(const CBigNumMont&);
+
+public:
+    explicit CBigNumMont(const CBigNum& m) : modulus(m), pmont(NULL)
+    {
+        // Montgomery reduction needs an odd modulus; even ones fall back to BN_mod_exp
+        if (!BN_is_odd(&modulus))
+            return;
+        pmont = BN_MONT_CTX_new();
+        if (pmont == NULL)
+            throw bignum_error("CBigNumMont : BN_MONT_CTX_new() returned NULL");
+        if (!BN_MONT_CTX_set(pmont, &modulus, CAutoBN_CTX())) {
+            BN_MONT_CTX_free(pmont);
+            throw bignum_error("CBigNumMont : BN_MONT_CTX_set failed");
+        }
+    }
+
+    ~CBigNumMont()
+    {
+        if (pmont != NULL)
+            BN_MONT_CTX_free(pmont);
+    }
+
+    const CBigNum& getModulus() const { return modulus; }
+    BN_MONT_CTX* get() const { return pmont; }
+
+    /**
+     * modular exponentiation: base^e mod m, same result as base.pow_mod(e, m)
+     * @param base the base
+     * @param e exponent, may be negative
+     */
+    CBigNum pow_mod(const CBigNum& base, const CBigNum& e) const
+    {
+        if (pmont == NULL)
+            return base.pow_mod(e, modulus);
+
+        CAutoBN_CTX pctx;
+        CBigNum ret;
+        if (e < 0) {
+            // g^-x = (g^-1)^x
+            CBigNum inv = base.inverse(modulus);
+            CBigNum posE = e * -1;
+            if (!BN_mod_exp_mont(&ret, &inv, &posE, &modulus, pctx, pmont))
+                throw bignum_error("CBigNumMont::pow_mod : BN_mod_exp_mont failed on negative exponent");
+        } else if (!BN_mod_exp_mont(&ret, &base, &e, &modulus, pctx, pmont)) {
+            throw bignum_error("CBigNumMont::pow_mod : BN_mod_exp_mont failed");
+        }
+        return ret;
+    }
+};
+
+/**
+ * Fixed-base exponentiation table for a generator g modulo m.
+ *
+ * For every 4-bit window i of the exponent the table holds
+ * g^(d * 16^i), d = 1..15, in Montgomery form, so g^e for an exponent of up
+ * to nBits bits costs one Montgomery multiplication per non-zero window and
+ * no squarings. Wider exponents are split at nBits and the high part is
+ * raised with a regular exponentiation of g^(2^nBits). Like CBigNumMont the
+ * table is immutable once built.
+ */
+class CBigNumFixedBase
+{
+private:
+    static const unsigned int WINDOW_BITS = 4;
+    static const unsigned int WINDOW_SIZE = (1 << WINDOW_BITS) - 1;
+
+    CBigNum base;
+    boost::shared_ptr<const CBigNumMont> mont;
+    unsigned int nBits;
+    std::vector<CBigNum> vTable;
+    CBigNum bnTop;  // g^(2^nBits) mod m, used for exponents wider than the table
+
+public:
+    CBigNumFixedBase(const CBigNum& g, const boost::shared_ptr<const CBigNumMont>& montIn, unsigned int nBitsIn)
+        : base(g), mont(montIn), nBits(0)
+    {
+        if (mont->get() == NULL)
+            return;
+        nBits = ((nBitsIn + WINDOW_BITS - 1) / WINDOW_BITS) * WINDOW_BITS;
+        const CBigNum& m = mont->getModulus();
+        CAutoBN_CTX pctx;
+
+        CBigNum bnWindow = g % m;
+        if (!BN_to_montgomery(&bnWindow, &bnWindow, mont->get(), pctx))
+            throw bignum_error("CBigNumFixedBase : BN_to_montgomery failed");
+
+        vTable.resize((nBits / WINDOW_BITS) * WINDOW_SIZE);
+        for (unsigned int i = 0; i < nBits / WINDOW_BITS; i++) {
+            CBigNum* pEntry = &vTable[i * WINDOW_SIZE];
+            pEntry[0] = bnWindow;
+            for (unsigned int d = 1; d < WINDOW_SIZE; d++) {
+                if (!BN_mod_mul_montgomery(&pEntry[d], &pEntry[d - 1], &bnWindow, mont->get(), pctx))
+                    throw bignum_error("CBigNumFixedBase : BN_mod_mul_montgomery failed");
+            }
+            // next window base: g^(16^(i+1)) = g^(15 * 16^i) * g^(16^i)
+            if (!BN_mod_mul_montgomery(&bnWindow, &pEntry[WINDOW_SIZE - 1], &bnWindow, mont->get(), pctx))
+                throw bignum_error("CBigNumFixedBase : BN_mod_mul_montgomery failed");
+        }
+        if (!BN_from_montgomery(&bnTop, &bnWindow, mont->get(), pctx))
+            throw bignum_error("CBigNumFixedBase : BN_from_montgomery failed");
+    }
+
+    const CBigNum& getBase() const { return base; }
+
+    /**
+     * modular exponentiation: g^e mod m, same result as g.pow_mod(e, m)
+     * @param e exponent, may be negative
+     */
+    CBigNum pow(const CBigNum& e) const
+    {
+        if (nBits == 0)
+            return mont->pow_mod(base, e);
+        if (e < 0)
+            return pow(e * -1).inverse(mont->getModulus());
+
+        CBigNum bnLow = e;
+        CBigNum bnHigh;
+        if ((unsigned int)e.bitSize() > nBits) {
+            bnHigh = e >> nBits;
+            if (!BN_mask_bits(&bnLow, nBits))
+                throw bignum_error("CBigNumFixedBase::pow : BN_mask_bits failed");
+        }
+
+        CAutoBN_CTX pctx;
+        CBigNum ret;
+        bool fOne = true;
+        const int nLowBits = bnLow.bitSize();
+        for (int nWindow = 0; nWindow * (int)WINDOW_BITS < nLowBits; nWindow++) {
+            unsigned int d = 0;
+            for (int j = WINDOW_BITS - 1; j >= 0; j--)
+                d = (d << 1) | (BN_is_bit_set(&bnLow, nWindow * WINDOW_BITS + j) ? 1 : 0);
+            if (d == 0)
+                continue;
+            const CBigNum& entry = vTable[nWindow * WINDOW_SIZE + d - 1];
+            if (fOne) {
+                ret = entry;
+                fOne = false;
+            } else if (!BN_mod_mul_montgomery(&ret, &ret, &entry, mont->get(), pctx)) {
+                throw bignum_error("CBigNumFixedBase::pow : BN_mod_mul_montgomery failed");
+            }
+        }
+        if (fOne)
+            ret = CBigNum(1) % mont->getModulus();
+        else if (!BN_from_montgomery(&ret, &ret, mont->get(), pctx))
+            throw bignum_error("CBigNumFixedBase::pow : BN_from_montgomery failed");
+
+        if (bnHigh > 0)
+            ret = ret.mul_mod(mont->pow_mod(bnTop, bnHigh), mont->getModulus());
+        return ret;
+    }
+};
+
 #endif
@@ -31,6 +31,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "zerocoinspendcache.h"
 
 #include "primitives/zerocoin.h"
 #include "libzerocoin/Denominations.h"
@@ -179,6 +180,17 @@ int nQueuedValidatedHeaders = 0;
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** Header-only block index entries learned from headers messages, by height. Requires cs_main. */
+set<pair<int, CBlockIndex*> > setHeadersAhead;
+
+/** Forget entries the active chain has caught up with and return how many are left. Requires cs_main. */
+unsigned int CountHeadersAhead()
+{
+    while (!setHeadersAhead.empty() && setHeadersAhead.begin()->first <= chainActive.Height())
+        setHeadersAhead.erase(setHeadersAhead.begin());
+    return setHeadersAhead.size();
+}
+
 /** Dirty block index entries. */
 set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -298,6 +310,8 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Last header accepted from this peer before header sync paused on MAX_HEADERS_AHEAD, or NULL.
+    CBlockIndex* pindexHeadersResume;
 
     CNodeState()
     {
@@ -311,6 +325,7 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        pindexHeadersResume = NULL;
     }
 };
 
@@ -499,6 +514,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     // download that next block if the window were 1 larger.
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
+    // Above the last checkpoint the stake kernel is checked as the block arrives, which needs its parent
+    // connected, so don't fetch past the tip there.
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
+    int nStakeWindowEnd = std::max(pcheckpoint ? pcheckpoint->nHeight : 0, chainActive.Height() + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
@@ -525,6 +544,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
+                if (pindex->nHeight > nStakeWindowEnd)
+                    return;
                 if (pindex->nHeight > nWindowEnd) {
                     // We reached the end of the window.
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
@@ -1065,7 +1086,7 @@ void FindMints(vector<CZerocoinMint> vMintsToFind, vector<CZerocoinMint>& vMints
             if(i % 1000 == 0)
                 LogPrintf("%s : scanned %d blocks\n", __func__, i - nZerocoinStartHeight);
 
-            if(chainActive[i]->vMintDenominationsInBlock.empty())
+            if(chainActive[i]->mintsInBlock.IsNull())
                 continue;
 
             CBlock block;
@@ -1203,6 +1224,31 @@ bool BlockToPubcoinList(const CBlock& block, list<PublicCoin>& listPubcoins)
 }
 
 //return a list of zerocoin mints contained in a specific block
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, list<PublicCoin>& listPubcoins, libzerocoin::CoinDenomination denom)
+{
+    if (zerocoinDB->ReadBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), listPubcoins, denom))
+        return true;
+
+    // the block was connected before the pubcoin index existed, read it once and index it
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s : failed to read block %d from disk", __func__, pindex->nHeight);
+
+    list<PublicCoin> listBlockPubcoins;
+    if (!BlockToPubcoinList(block, listBlockPubcoins))
+        return error("%s : failed to get pubcoins from block %d", __func__, pindex->nHeight);
+
+    if (chainActive.Contains(pindex))
+        zerocoinDB->WriteBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), listBlockPubcoins);
+
+    for (const PublicCoin& pubcoin : listBlockPubcoins) {
+        if (denom == libzerocoin::ZQ_ERROR || pubcoin.getDenomination() == denom)
+            listPubcoins.emplace_back(pubcoin);
+    }
+
+    return true;
+}
+
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints)
 {
     for (const CTransaction tx : block.vtx) {
@@ -1309,7 +1355,44 @@ bool IsZerocoinSpendUnknown(CoinSpend coinSpend, uint256 hashTx, CValidationStat
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state)
+bool CZerocoinSpendCheck::operator()()
+{
+    CoinSpend spend = TxInToZerocoinSpend(txin);
+    Accumulator accumulator(Params().Zerocoin_Params(), spend.getDenomination(), bnAccumulatorValue);
+    if (!spend.Verify(accumulator))
+        return false;
+
+    if (cacheStore)
+        SetZerocoinSpendVerified(txin, nAccumulatorChecksum);
+    return true;
+}
+
+static CCheckQueue<CZerocoinSpendCheck> zerocoinspendcheckqueue(1);
+//! CheckBlock and AcceptToMemoryPool may both drive zerocoinspendcheckqueue, from different threads
+static boost::mutex cs_zerocoinspendcheckqueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("umbra-zcspendch");
+    zerocoinspendcheckqueue.Thread();
+}
+
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks)
+{
+    if (vChecks.size() < 2 || nScriptCheckThreads == 0) {
+        BOOST_FOREACH (CZerocoinSpendCheck& check, vChecks)
+            if (!check())
+                return false;
+        return true;
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs_zerocoinspendcheckqueue);
+    CCheckQueueControl<CZerocoinSpendCheck> control(&zerocoinspendcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1331,8 +1414,8 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
     uint256 hashTxOut = txTemp.GetHash();
 
     bool fValidated = false;
+    std::vector<CZerocoinSpendCheck> vChecks;
     set<CBigNum> serials;
-    list<CoinSpend> vSpends;
     CAmount nTotalRedeemed = 0;
     for (const CTxIn& txin : tx.vin) {
 
@@ -1341,7 +1424,6 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
             continue;
 
         CoinSpend newSpend = TxInToZerocoinSpend(txin);
-        vSpends.push_back(newSpend);
 
         //check that the denomination is valid
         if (newSpend.getDenomination() == ZQ_ERROR)
@@ -1355,18 +1437,18 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
         if (newSpend.getTxOutHash() != hashTxOut)
             return state.DoS(100, error("Zerocoinspend does not use the same txout that was used in the SoK"));
 
-        // Skip signature verification during initial block download
-        if (fVerifySignature) {
+        // Skip signature verification during initial block download, and for
+        // spends whose proof already verified when they entered the mempool
+        if (fVerifySignature && !IsZerocoinSpendVerified(txin, newSpend.getAccumulatorChecksum())) {
             //see if we have record of the accumulator used in the spend tx
             CBigNum bnAccumulatorValue = 0;
             if(!zerocoinDB->ReadAccumulatorValue(newSpend.getAccumulatorChecksum(), bnAccumulatorValue))
                 return state.DoS(100, error("Zerocoinspend could not find accumulator associated with checksum"));
 
-            Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
-
-            //Check that the coin is on the accumulator
-            if(!newSpend.Verify(accumulator))
-                return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+            //Check that the coin is on the accumulator, deferred to the zerocoin check queue.
+            //Only standalone transaction checks (mempool) populate the verified spend cache;
+            //block checks just consume it.
+            vChecks.push_back(CZerocoinSpendCheck(txin, newSpend.getAccumulatorChecksum(), bnAccumulatorValue, pvZerocoinChecks == NULL));
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1383,23 +1465,20 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
         return state.DoS(100, error("Transaction spend more than was redeemed in zerocoins"));
     }
 
-    // Send signal to wallet if this is ours
-    if (pwalletMain) {
-        CWalletDB walletdb(pwalletMain->strWalletFile);
-        list <CBigNum> listMySerials = walletdb.ListMintedCoinsSerial();
-        for (const auto& newSpend : vSpends) {
-            list<CBigNum>::iterator it = find(listMySerials.begin(), listMySerials.end(), newSpend.getCoinSerialNumber());
-            if (it != listMySerials.end()) {
-                LogPrintf("%s: %s detected spent zerocoin mint in transaction %s \n", __func__, it->GetHex(), tx.GetHash().GetHex());
-                pwalletMain->NotifyZerocoinChanged(pwalletMain, it->GetHex(), "Used", CT_UPDATED);
-            }
+    if (pvZerocoinChecks) {
+        pvZerocoinChecks->reserve(pvZerocoinChecks->size() + vChecks.size());
+        BOOST_FOREACH (CZerocoinSpendCheck& check, vChecks) {
+            pvZerocoinChecks->push_back(CZerocoinSpendCheck());
+            check.swap(pvZerocoinChecks->back());
         }
+    } else if (!RunZerocoinSpendChecks(vChecks)) {
+        return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
     }
 
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1457,7 +1536,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
             bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1699,7 +1778,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
@@ -1715,6 +1794,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // A full pool only takes transactions paying more than what it last evicted
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (fLimitFree && mempoolRejectFee > 0 && nFees < mempoolRejectFee && !tx.IsZerocoinSpend())
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.IsZerocoinMint()) {
                 if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1752,6 +1838,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Bound the package the transaction joins, the pool's aggregates make accepting it cost as much as
+        // the package is large
+        {
+            LOCK(pool.cs);
+            std::set<uint256> setAncestors;
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT),
+                    GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000, GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT),
+                    GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000, errString))
+                return state.DoS(0, error("AcceptToMemoryPool : %s %s", hash.ToString(), errString),
+                    REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1773,6 +1872,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Keep the pool within -maxmempool, and refuse the transaction if it is the one that did not fit
+        pool.Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool : mempool full, fee of %s too low", hash.ToString()),
+                REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -2097,6 +2203,92 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CBlockIndex* pindex)
+{
+    // Start at the index header WriteBlockToDisk puts in front of the block
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk : no index header in front of block %s", pindex->GetBlockHash().ToString());
+    pos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk : OpenBlockFile failed");
+
+    CBlockHeader header;
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("ReadRawBlockFromDisk : bad magic in front of block %s", pindex->GetBlockHash().ToString());
+        if (nSize == 0 || nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("ReadRawBlockFromDisk : bad size %u for block %s", nSize, pindex->GetBlockHash().ToString());
+
+        ssBlock.clear();
+        ssBlock.resize(nSize);
+        filein.read((char*)&ssBlock[0], nSize);
+
+        // Deserialize the header alone, leaving the transactions untouched
+        ssBlock >> header;
+        ssBlock.Rewind(::GetSerializeSize(header, SER_NETWORK, PROTOCOL_VERSION));
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    if (header.GetHash() != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk : GetHash() doesn't match index for block %s", pindex->GetBlockHash().ToString());
+    return true;
+}
+
+bool CRawBlockCache::Get(const uint256& hash, std::shared_ptr<const CDataStream>& pssBlock)
+{
+    LOCK(cs);
+    std::map<uint256, BlockList::iterator>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return false;
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    pssBlock = it->second->second;
+    return true;
+}
+
+void CRawBlockCache::Insert(const uint256& hash, const std::shared_ptr<const CDataStream>& pssBlock)
+{
+    LOCK(cs);
+    if (mapBlocks.count(hash))
+        return;
+    listBlocks.push_front(std::make_pair(hash, pssBlock));
+    mapBlocks[hash] = listBlocks.begin();
+    nSize += pssBlock->size();
+    while (nSize > nMaxSize && listBlocks.size() > 1) {
+        nSize -= listBlocks.back().second->size();
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+    }
+}
+
+size_t CRawBlockCache::GetSize()
+{
+    LOCK(cs);
+    return nSize;
+}
+
+static CRawBlockCache rawBlockCache(MAX_RAW_BLOCK_CACHE_SIZE);
+
+bool GetRawBlock(const CBlockIndex* pindex, std::shared_ptr<const CDataStream>& pssBlock)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    if (rawBlockCache.Get(hash, pssBlock))
+        return true;
+
+    std::shared_ptr<CDataStream> pssRead(new CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+    if (!ReadRawBlockFromDisk(*pssRead, pindex))
+        return false;
+    pssBlock = pssRead;
+    rawBlockCache.Insert(hash, pssBlock);
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2557,6 +2749,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if(!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        if (!zerocoinDB->EraseBlockPubcoins(pindex->nHeight))
+            return error("DisconnectBlock(): failed to erase pubcoin index");
     }
 
     if (pfClean) {
@@ -2600,131 +2795,254 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-void RecalculateZUMBMinted()
+/**
+ * Closure representing the hashing of one block header. Legacy (nVersion < 4)
+ * headers hash with the 34-round XEVAN chain, which is expensive enough that
+ * batches of them are worth spreading over the header hashing threads.
+ */
+class CHeaderHashCheck
 {
-    CBlockIndex *pindex = chainActive[Params().Zerocoin_AccumulatorStartHeight()];
-    int nHeightEnd = chainActive.Height();
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
+private:
+    const CBlockHeader* pheader;
+    uint256* phash;
 
-        //overwrite possibly wrong vMintsInBlock data
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+public:
+    CHeaderHashCheck() : pheader(NULL), phash(NULL) {}
+    CHeaderHashCheck(const CBlockHeader* pheaderIn, uint256* phashIn) : pheader(pheaderIn), phash(phashIn) {}
 
-        std::list<CZerocoinMint> listMints;
-        BlockToZerocoinMintList(block, listMints);
+    bool operator()()
+    {
+        *phash = pheader->GetHash();
+        return true;
+    }
+
+    void swap(CHeaderHashCheck& check)
+    {
+        std::swap(pheader, check.pheader);
+        std::swap(phash, check.phash);
+    }
+};
 
-        vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
-        for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+static CCheckQueue<CHeaderHashCheck> headerhashqueue(16);
+//! Only one master may drive headerhashqueue at a time (import and message handler threads both use it)
+static boost::mutex cs_headerhashqueue;
 
-        //Record mints to disk
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
+void ThreadHeaderHash()
+{
+    RenameThread("umbra-hdrhash");
+    headerhashqueue.Thread();
+}
 
-        if (pindex->nHeight < nHeightEnd)
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+void HashBlockHeaders(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<uint256>& vHashes)
+{
+    vHashes.resize(vpHeaders.size());
+    if (vpHeaders.size() < 2 || nScriptCheckThreads == 0) {
+        for (unsigned int i = 0; i < vpHeaders.size(); i++)
+            vHashes[i] = vpHeaders[i]->GetHash();
+        return;
     }
 
-    pblocktree->Flush();
+    std::vector<CHeaderHashCheck> vChecks;
+    vChecks.reserve(vpHeaders.size());
+    for (unsigned int i = 0; i < vpHeaders.size(); i++)
+        vChecks.push_back(CHeaderHashCheck(vpHeaders[i], &vHashes[i]));
+
+    boost::unique_lock<boost::mutex> lock(cs_headerhashqueue);
+    CCheckQueueControl<CHeaderHashCheck> control(&headerhashqueue);
+    control.Add(vChecks);
+    control.Wait();
 }
 
-void RecalculateZUMBSpent()
+bool CSupplyReadCheck::operator()()
 {
-    CBlockIndex* pindex = chainActive[Params().Zerocoin_AccumulatorStartHeight()];
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
+    if (!fMintsFromBlock && !(nFlags & (RECALC_ZUMB_SPENT | RECALC_UMB_SUPPLY)))
+        return true;
 
-        //Rewrite zUMB supply
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+    CBlock block;
+    if (!ReadBlockFromDisk(block, posBlock) || block.GetHash() != hashBlock)
+        return error("CSupplyReadCheck() : failed to read block %d", nHeight);
 
-        list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block);
+    // mints normally come from the pubcoin index, only blocks connected before it existed are decoded here
+    if (fMintsFromBlock) {
+        if (!BlockToPubcoinList(block, pdata->listPubcoins))
+            return error("CSupplyReadCheck() : failed to get pubcoins of block %d", nHeight);
+        for (const PublicCoin& pubcoin : pdata->listPubcoins)
+            pdata->mints.Add(pubcoin.getDenomination());
+    }
 
-        //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+    if (nFlags & RECALC_ZUMB_SPENT)
+        pdata->listSpends = ZerocoinSpendListFromBlock(block);
 
-        //Add mints to zUMB supply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-        }
+    if (!(nFlags & RECALC_UMB_SUPPLY))
+        return true;
 
-        //Remove spends from zUMB supply
-        for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
+    // the undo data holds the spent outputs, which saves looking up every previous transaction
+    CBlockUndo blockUndo;
+    bool fUndo = !posUndo.IsNull() && blockUndo.ReadFromDisk(posUndo, hashPrevBlock) &&
+                 blockUndo.vtxundo.size() + 1 == block.vtx.size();
 
-        //Rewrite money supply
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            if (tx.IsCoinBase())
+                break;
 
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+            if (tx.vin[j].scriptSig.IsZerocoinSpend()) {
+                pdata->nValueIn += tx.vin[j].nSequence * COIN;
+                continue;
+            }
+
+            if (fUndo && !tx.IsZerocoinSpend() && j < blockUndo.vtxundo[i - 1].vprevout.size())
+                pdata->nValueIn += blockUndo.vtxundo[i - 1].vprevout[j].txout.nValue;
+            else
+                pdata->vPrevoutsMissing.push_back(tx.vin[j].prevout);
+        }
+
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            if (j == 0 && tx.IsCoinStake())
+                continue;
+
+            pdata->nValueOut += tx.vout[j].nValue;
+        }
     }
-    pblocktree->Flush();
+
+    return true;
 }
 
-bool RecalculateUMBSupply(int nHeightStart)
-{
-    if (nHeightStart > chainActive.Height())
-        return false;
+//! Number of blocks that are read ahead and written back together
+static const unsigned int SUPPLY_RECALC_BATCH_SIZE = 1000;
 
-    CBlockIndex* pindex = chainActive[nHeightStart];
-    CAmount nSupplyPrev = pindex->pprev->nMoneySupply;
+static CCheckQueue<CSupplyReadCheck> supplyreadqueue(8);
+//! Only one master may drive supplyreadqueue at a time
+static boost::mutex cs_supplyreadqueue;
 
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
+void ThreadSupplyRead()
+{
+    RenameThread("umbra-supplyrd");
+    supplyreadqueue.Thread();
+}
 
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+bool RunSupplyReadChecks(std::vector<CSupplyReadCheck>& vChecks)
+{
+    if (vChecks.size() < 2 || nScriptCheckThreads == 0) {
+        BOOST_FOREACH (CSupplyReadCheck& check, vChecks)
+            if (!check())
+                return false;
+        return true;
+    }
 
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction tx : block.vtx) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                if (tx.IsCoinBase())
-                    break;
+    boost::unique_lock<boost::mutex> lock(cs_supplyreadqueue);
+    CCheckQueueControl<CSupplyReadCheck> control(&supplyreadqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
 
-                if (tx.vin[i].scriptSig.IsZerocoinSpend()) {
-                    nValueIn += tx.vin[i].nSequence * COIN;
-                    continue;
+/**
+ * Rewrite the supply fields selected by nFlags of every block index from pindexStart to the tip.
+ * Blocks are read and decoded a batch at a time on the supply reading threads, then folded
+ * into the index in chain order and written back with one database batch.
+ */
+static bool RecalculateSupply(CBlockIndex* pindexStart, int nFlags)
+{
+    LOCK(cs_main);
+    CAmount nSupplyPrev = pindexStart->pprev ? pindexStart->pprev->nMoneySupply : 0;
+    CBlockIndex* pindex = pindexStart;
+    std::vector<CBlockIndex*> vBatch;
+    std::vector<CSupplyBlockData> vData;
+
+    while (pindex) {
+        vBatch.clear();
+        for (; pindex && vBatch.size() < SUPPLY_RECALC_BATCH_SIZE; pindex = chainActive.Next(pindex))
+            vBatch.push_back(pindex);
+        vData.assign(vBatch.size(), CSupplyBlockData());
+
+        // everything the reading threads need from the index and the pubcoin index is resolved here
+        std::vector<CSupplyReadCheck> vChecks;
+        vChecks.reserve(vBatch.size());
+        for (unsigned int i = 0; i < vBatch.size(); i++) {
+            const CBlockIndex* pindexRead = vBatch[i];
+            CSupplyBlockData& data = vData[i];
+            if (nFlags & RECALC_ZUMB_MINTED) {
+                std::list<PublicCoin> listPubcoins;
+                if (zerocoinDB->ReadBlockPubcoins(pindexRead->nHeight, pindexRead->GetBlockHash(), listPubcoins)) {
+                    for (const PublicCoin& pubcoin : listPubcoins)
+                        data.mints.Add(pubcoin.getDenomination());
+                } else {
+                    data.fPubcoinsFromBlock = true;
                 }
+            }
+
+            uint256 hashPrevBlock = pindexRead->pprev ? pindexRead->pprev->GetBlockHash() : uint256();
+            vChecks.push_back(CSupplyReadCheck(pindexRead->GetBlockPos(), pindexRead->GetUndoPos(), pindexRead->GetBlockHash(), hashPrevBlock,
+                                               pindexRead->nHeight, nFlags, data.fPubcoinsFromBlock, &data));
+        }
+
+        if (!RunSupplyReadChecks(vChecks))
+            return error("%s : failed to read blocks %d to %d", __func__, vBatch.front()->nHeight, vBatch.back()->nHeight);
 
-                COutPoint prevout = tx.vin[i].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
-                nValueIn += txPrev.vout[prevout.n].nValue;
+        for (unsigned int i = 0; i < vBatch.size(); i++) {
+            CBlockIndex* pindexUpdate = vBatch[i];
+            CSupplyBlockData& data = vData[i];
+            if (pindexUpdate->nHeight % 1000 == 0)
+                LogPrintf("%s : block %d...\n", __func__, pindexUpdate->nHeight);
+
+            //overwrite possibly wrong mints in block data
+            if (nFlags & RECALC_ZUMB_MINTED) {
+                pindexUpdate->mintsInBlock = data.mints;
+                if (data.fPubcoinsFromBlock)
+                    zerocoinDB->WriteBlockPubcoins(pindexUpdate->nHeight, pindexUpdate->GetBlockHash(), data.listPubcoins);
             }
 
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                if (i == 0 && tx.IsCoinStake())
-                    continue;
+            if (nFlags & RECALC_ZUMB_SPENT) {
+                //Reset the supply to previous block, add the mints and remove the spends
+                pindexUpdate->zerocoinSupply = pindexUpdate->pprev->zerocoinSupply;
+                for (auto denom : libzerocoin::zerocoinDenomList)
+                    pindexUpdate->zerocoinSupply.at(denom) += pindexUpdate->mintsInBlock.Count(denom);
+                for (auto denom : data.listSpends)
+                    pindexUpdate->zerocoinSupply.at(denom)--;
+            }
 
-                nValueOut += tx.vout[i].nValue;
+            if (nFlags & RECALC_UMB_SUPPLY) {
+                // blocks without undo data fall back to looking up the previous transactions
+                for (const COutPoint& prevout : data.vPrevoutsMissing) {
+                    CTransaction txPrev;
+                    uint256 hashBlock;
+                    if (!GetTransaction(prevout.hash, txPrev, hashBlock, true))
+                        return error("%s : failed to find input %s of block %d", __func__, prevout.ToString(), pindexUpdate->nHeight);
+                    data.nValueIn += txPrev.vout[prevout.n].nValue;
+                }
+
+                pindexUpdate->nMoneySupply = nSupplyPrev + data.nValueOut - data.nValueIn;
+                nSupplyPrev = pindexUpdate->nMoneySupply;
             }
         }
 
-        // Rewrite money supply
-        pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
-        nSupplyPrev = pindex->nMoneySupply;
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
-
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+        if (!pblocktree->WriteBlockIndexes(std::vector<const CBlockIndex*>(vBatch.begin(), vBatch.end())))
+            return error("%s : failed to write block index", __func__);
     }
+
     pblocktree->Flush();
     return true;
 }
 
+void RecalculateZUMBMinted()
+{
+    assert(RecalculateSupply(chainActive[Params().Zerocoin_AccumulatorStartHeight()], RECALC_ZUMB_MINTED));
+}
+
+void RecalculateZUMBSpent()
+{
+    assert(RecalculateSupply(chainActive[Params().Zerocoin_AccumulatorStartHeight()], RECALC_ZUMB_SPENT));
+}
+
+bool RecalculateUMBSupply(int nHeightStart)
+{
+    if (nHeightStart > chainActive.Height())
+        return false;
+
+    return RecalculateSupply(chainActive[nHeightStart], RECALC_UMB_SUPPLY);
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2914,32 +3232,32 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Initialize zerocoin supply to the supply from previous block
     if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3) {
         for (auto& denom : zerocoinDenomList) {
-            pindex->mapZerocoinSupply.at(denom) = pindex->pprev->mapZerocoinSupply.at(denom);
+            pindex->zerocoinSupply.at(denom) = pindex->pprev->zerocoinSupply.at(denom);
         }
     }
 
     // Track zerocoin money supply
     CAmount nAmountZerocoinSpent = 0;
-    pindex->vMintDenominationsInBlock.clear();
+    pindex->mintsInBlock.SetNull();
     if (pindex->pprev) {
         for (auto& m : listMints) {
             libzerocoin::CoinDenomination denom = m.GetDenomination();
-            pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-            pindex->mapZerocoinSupply.at(denom)++;
+            pindex->mintsInBlock.Add(m.GetDenomination());
+            pindex->zerocoinSupply.at(denom)++;
         }
 
         for (auto& denom : listSpends) {
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->zerocoinSupply.at(denom)--;
             nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
             // zerocoin failsafe
-            if (pindex->mapZerocoinSupply.at(denom) < 0)
+            if (pindex->zerocoinSupply.at(denom) < 0)
                 return state.DoS(100, error("Block contains zerocoins that spend more than are in the available supply to spend"));
         }
     }
 
     for (auto& denom : zerocoinDenomList) {
-        LogPrint("zero" "%s coins for denomination %d pubcoin %s\n", __func__, pindex->mapZerocoinSupply.at(denom), denom);
+        LogPrint("zero" "%s coins for denomination %d pubcoin %s\n", __func__, pindex->zerocoinSupply.at(denom), denom);
     }
 
     // track money supply and mint amount info
@@ -3017,6 +3335,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    // Index the pubcoins of this block so accumulators and witnesses do not have to read it back from disk
+    if (pindex->nHeight >= Params().Zerocoin_AccumulatorStartHeight()) {
+        std::list<PublicCoin> listPubcoins;
+        if (!BlockToPubcoinList(block, listPubcoins))
+            return error("ConnectBlock() : failed to get pubcoins from block");
+        if (!zerocoinDB->WriteBlockPubcoins(pindex->nHeight, pindex->GetBlockHash(), listPubcoins))
+            return state.Abort("Failed to write pubcoin index");
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -3108,6 +3435,7 @@ void FlushStateToDisk()
 void static UpdateTip(CBlockIndex* pindexNew)
 {
     chainActive.SetTip(pindexNew);
+    stakeModifierIndex.SetTip(pindexNew);
 
     // If turned on AutoZeromint will automatically convert UMB to zUMB
     if (pwalletMain->isZeromintEnabled ())
@@ -3214,6 +3542,17 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
             return state.Abort("Failed to read block");
         pblock = &block;
     }
+    // Proof-of-stake of blocks accepted ahead of the tip is checked now that the parent is connected
+    if (pblock->IsProofOfStake() && pindexNew->hashProofOfStake == 0) {
+        uint256 hashProofOfStake;
+        if (!CheckProofOfStake(*pblock, hashProofOfStake)) {
+            state.DoS(100, error("ConnectTip() : check proof-of-stake failed for block %s", pindexNew->GetBlockHash().ToString()),
+                REJECT_INVALID, "bad-proof-of-stake");
+            InvalidBlockFound(pindexNew, state);
+            return false;
+        }
+        pindexNew->hashProofOfStake = hashProofOfStake;
+    }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
     nTimeReadFromDisk += nTime2 - nTime1;
@@ -3547,6 +3886,7 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
+            GetMainSignals().UpdatedBlockTip(pindexNewTip);
         }
     } while (pindexMostWork != chainActive.Tip());
     CheckBlockIndex();
@@ -3656,6 +3996,10 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
 
+        // a bare header carries no coinstake, but past the PoW phase every valid block is proof-of-stake
+        if (block.vtx.empty() && pindexNew->nHeight > Params().LAST_POW_BLOCK())
+            pindexNew->SetProofOfStake();
+
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
 
@@ -3667,7 +4011,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
         // ppcoin: record proof-of-stake hash value
-        if (pindexNew->IsProofOfStake()) {
+        if (pindexNew->IsProofOfStake() && !block.vtx.empty()) {
             if (!mapProofOfStake.count(hash))
                 LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
             pindexNew->hashProofOfStake = mapProofOfStake[hash];
@@ -3957,8 +4301,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // Check transactions
     bool fZerocoinActive = true;
     vector<CBigNum> vBlockSerials;
+    // zerocoin spend proofs of the whole block are collected and verified together in parallel
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_StartHeight(), state))
+        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_StartHeight(), state, &vZerocoinChecks))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zUmbra spends in this block
@@ -3975,6 +4321,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    if (!RunZerocoinSpendChecks(vZerocoinChecks))
+        return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+            REJECT_INVALID, "bad-zc-spend");
+
 
     unsigned int nSigOps = 0;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -3988,7 +4338,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
+bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev, bool fCheckStake)
 {
     if (pindexPrev == NULL)
         return error("%s : null pindexPrev for block %s", __func__, block.GetHash().ToString().c_str());
@@ -4008,7 +4358,7 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
     if (block.nBits != nBitsRequired)
         return error("%s : incorrect proof of work at %d", __func__, pindexPrev->nHeight + 1);
 
-    if (block.IsProofOfStake()) {
+    if (block.IsProofOfStake() && fCheckStake) {
         uint256 hashProofOfStake;
         uint256 hash = block.GetHash();
 
@@ -4095,11 +4445,11 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phash)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash ? *phash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex* pindex = NULL;
 
@@ -4131,6 +4481,10 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
                              REJECT_INVALID, "bad-prevblk");
     }
 
+    // CheckBlockHeader was told to skip this, as the proof type depends on the height
+    if (pindexPrev && pindexPrev->nHeight + 1 <= Params().LAST_POW_BLOCK() && !CheckProofOfWork(hash, block.nBits))
+        return state.DoS(50, error("%s : proof of work failed", __func__), REJECT_INVALID, "high-hash");
+
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
@@ -4161,18 +4515,38 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                              REJECT_INVALID, "bad-prevblk");
     }
 
-    if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev))
+    // The stake kernel can only be checked on top of its parent. Blocks fetched ahead of the tip during
+    // headers-first sync get it checked in ConnectTip, but only where the last checkpoint pins their hash.
+    bool fCheckStake = true;
+    CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint();
+    if (pindexPrev && pindexPrev != chainActive.Tip() && pcheckpoint && pindexPrev->nHeight < pcheckpoint->nHeight &&
+        pcheckpoint->GetAncestor(pindexPrev->nHeight + 1)->GetBlockHash() == block.GetHash())
+        fCheckStake = false;
+
+    if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev, fCheckStake))
         return false;
 
     if (!AcceptBlockHeader(block, state, &pindex))
         return false;
 
+    setHeadersAhead.erase(make_pair(pindex->nHeight, pindex));
+
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
         // TODO: deal better with duplicate blocks.
         // return state.DoS(20, error("AcceptBlock() : already have block %d %s", pindex->nHeight, pindex->GetBlockHash().ToString()), REJECT_DUPLICATE, "duplicate");
         return true;
     }
 
+    if (block.IsProofOfStake() && pindex->prevoutStake.IsNull()) {
+        // index was built from the header alone, fill in what only the coinstake carries
+        pindex->SetProofOfStake();
+        pindex->prevoutStake = block.vtx[1].vin[0].prevout;
+        pindex->nStakeTime = block.nTime;
+        setStakeSeen.insert(make_pair(pindex->prevoutStake, pindex->nStakeTime));
+        if (fCheckStake && mapProofOfStake.count(pindex->GetBlockHash()))
+            pindex->hashProofOfStake = mapProofOfStake[pindex->GetBlockHash()];
+    }
+
     if ((!fAlreadyCheckedBlock && !CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -4577,6 +4951,7 @@ bool static LoadBlockIndexDB()
 
         //set the chain to the block before lastMeta so that the meta block will be seen as new
         chainActive.SetTip(pindexLastMeta->pprev);
+        stakeModifierIndex.SetTip(pindexLastMeta->pprev);
 
         //Process the lastMetaBlock again, using the known location on disk
         CDiskBlockPos blockPos = pindexLastMeta->GetBlockPos();
@@ -4637,6 +5012,7 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    stakeModifierIndex.SetTip(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -4740,6 +5116,7 @@ void UnloadBlockIndex()
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    stakeModifierIndex.SetTip(NULL);
     pindexBestInvalid = NULL;
 }
 
@@ -4803,85 +5180,115 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        bool fEnd = false;
+        while (!fEnd && !blkdat.eof()) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
+            // Read ahead a batch of blocks so their header hashes can be computed in parallel
+            std::vector<CBlock> vBlocks;
+            std::vector<CDiskBlockPos> vBlockPos;
+            vBlocks.reserve(IMPORT_HASH_BATCH_SIZE);
+            while (vBlocks.size() < IMPORT_HASH_BATCH_SIZE && !blkdat.eof()) {
+                blkdat.SetPos(nRewind);
+                nRewind++;         // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(Params().MessageStart()[0]);
+                    nRewind = blkdat.GetPos() + 1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    fEnd = true;
+                    break;
+                }
+                try {
+                    // read block
+                    uint64_t nBlockPos = blkdat.GetPos();
                     if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+                        dbp->nPos = nBlockPos;
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    blkdat.SetPos(nBlockPos);
+                    CBlock block;
+                    blkdat >> block;
+                    nRewind = blkdat.GetPos();
+                    // only blocks that deserialized completely join the batch
+                    vBlocks.push_back(block);
+                    vBlockPos.push_back(dbp ? *dbp : CDiskBlockPos());
+                } catch (std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            std::vector<const CBlockHeader*> vpHeaders;
+            vpHeaders.reserve(vBlocks.size());
+            BOOST_FOREACH (const CBlock& block, vBlocks)
+                vpHeaders.push_back(&block);
+            // The headers are hashed in place, so ProcessNewBlock below finds each hash memoized
+            std::vector<uint256> vHashes;
+            HashBlockHeaders(vpHeaders, vHashes);
+
+            for (unsigned int i = 0; i < vBlocks.size(); i++) {
+                try {
+                    CBlock& block = vBlocks[i];
+                    CDiskBlockPos* pblockpos = dbp ? &vBlockPos[i] : NULL;
+
+                    // detect out of order blocks, and store them for later
+                    uint256 hash = vHashes[i];
+                    if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                            block.hashPrevBlock.ToString());
+                        if (dbp)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *pblockpos));
+                        continue;
+                    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        CValidationState state;
+                        if (ProcessNewBlock(state, NULL, &block, pblockpos))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fEnd = true;
+                            break;
+                        }
+                    } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                    }
+
+                    // Recursively process earlier encountered successors of this block
+                    deque<uint256> queue;
+                    queue.push_back(hash);
+                    while (!queue.empty()) {
+                        uint256 head = queue.front();
+                        queue.pop_front();
+                        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                        while (range.first != range.second) {
+                            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                            if (ReadBlockFromDisk(block, it->second)) {
+                                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                                    head.ToString());
+                                CValidationState dummy;
+                                if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
+                                    nLoaded++;
+                                    queue.push_back(block.GetHash());
+                                }
                             }
+                            range.first++;
+                            mapBlocksUnknownParent.erase(it);
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                } catch (std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
-            } catch (std::exception& e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
         }
     } catch (std::runtime_error& e) {
@@ -5194,14 +5601,17 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // Send block from disk as stored, no need to deserialize it
+                        std::shared_ptr<const CDataStream> pssBlock;
+                        if (!GetRawBlock((*mi).second, pssBlock))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", *pssBlock);
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5622,9 +6032,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (Params().HeadersFirstSyncingActive() && pfrom->nVersion >= HEADERS_FIRST_VERSION) {
+                        // Get the headers up to the announced block, SendMessages schedules the download.
+                        // Fetch it right away too when we are synced, so new blocks propagate without a round trip.
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        if (!IsInitialBlockDownload()) {
+                            vToFetch.push_back(inv);
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        }
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -5661,7 +6082,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -5693,16 +6114,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         LOCK(cs_main);
 
-        if (IsInitialBlockDownload())
-            return true;
-
         CBlockIndex* pindex = NULL;
         if (locator.IsNull()) {
             // If locator is null, return the hashStop block
@@ -5905,6 +6323,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole batch before taking cs_main; legacy XEVAN headers are costly
+        std::vector<const CBlockHeader*> vpHeaders;
+        vpHeaders.reserve(headers.size());
+        BOOST_FOREACH (const CBlockHeader& header, headers)
+            vpHeaders.push_back(&header);
+        std::vector<uint256> vHashes;
+        HashBlockHeaders(vpHeaders, vHashes);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5912,31 +6338,50 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
         CBlockIndex* pindexLast = NULL;
-        BOOST_FOREACH (const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // a bare header has no coinstake, so this checks the difficulty but not the stake kernel,
+            // which AcceptBlock or ConnectTip verify once the block itself arrives
+            CBlock block(header);
+            BlockMap::iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+            bool fNew = !mapBlockIndex.count(vHashes[n]);
+            if (mi != mapBlockIndex.end() && fNew && !CheckWork(block, mi->second)) {
+                Misbehaving(pfrom->GetId(), 50);
+                return error("header %s has incorrect work", vHashes[n].ToString());
+            }
+
+            if (fNew) {
+                // Only keep a bounded number of bare headers ahead of the tip; continue once blocks catch up
+                if (CountHeadersAhead() >= MAX_HEADERS_AHEAD) {
+                    LogPrint("net", "pausing header sync at %d with peer=%d, %u headers ahead of the tip\n",
+                        pindexLast ? pindexLast->nHeight : chainActive.Height(), pfrom->id, setHeadersAhead.size());
+                    State(pfrom->GetId())->pindexHeadersResume = pindexLast ? pindexLast : mi != mapBlockIndex.end() ? mi->second : NULL;
+                    break;
+                }
+            }
+
+            if (!AcceptBlockHeader(block, state, &pindexLast, &vHashes[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
                         Misbehaving(pfrom->GetId(), nDoS);
-                    std::string strError = "invalid header received " + header.GetHash().ToString();
+                    std::string strError = "invalid header received " + vHashes[n].ToString();
                     return error(strError.c_str());
                 }
-            }
+            } else if (fNew && pindexLast && !(pindexLast->nStatus & BLOCK_HAVE_DATA) && pindexLast->nHeight > chainActive.Height())
+                setHeadersAhead.insert(make_pair(pindexLast->nHeight, pindexLast));
         }
 
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (nCount == MAX_HEADERS_RESULTS && pindexLast && State(pfrom->GetId())->pindexHeadersResume == NULL) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -6455,10 +6900,21 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (Params().HeadersFirstSyncingActive() && pto->nVersion >= HEADERS_FIRST_VERSION) {
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                } else
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+            }
+        }
+
+        // Resume header sync once connected blocks made room ahead of the tip
+        if (state.pindexHeadersResume != NULL) {
+            if (CountHeadersAhead() + MAX_HEADERS_RESULTS <= MAX_HEADERS_AHEAD) {
+                LogPrint("net", "resume getheaders (%d) to peer=%d\n", state.pindexHeadersResume->nHeight, pto->id);
+                pto->PushMessage("getheaders", chainActive.GetLocator(state.pindexHeadersResume), uint256(0));
+                state.pindexHeadersResume = NULL;
             }
         }
 
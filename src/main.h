@@ -33,7 +33,9 @@
 
 #include <algorithm>
 #include <exception>
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -51,6 +53,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -60,8 +63,9 @@ struct CNodeStateStats;
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
-/** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
-static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -blockprioritysize, maximum space for zero/low-fee transactions. The priority pass walks
+ *  the whole pool, so it is off unless asked for **/
+static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 0;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -75,8 +79,22 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
 static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 5;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 5;
+/** Bytes of recently served blocks kept in their serialized form for getdata, getblock and REST */
+static const unsigned int MAX_RAW_BLOCK_CACHE_SIZE = 16 * 1000 * 1000;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxmempool, maximum megabytes of memory the mempool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, hours after which a transaction leaves the mempool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -98,11 +116,16 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of blocks read ahead by LoadExternalBlockFile so their header hashes can be computed in parallel. */
+static const unsigned int IMPORT_HASH_BATCH_SIZE = 16;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum number of headers without block data kept ahead of the active tip. Bare headers carry no
+ *  verifiable stake, so header sync pauses at this bound and resumes as blocks get connected. */
+static const unsigned int MAX_HEADERS_AHEAD = 4 * MAX_HEADERS_RESULTS;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -220,6 +243,15 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend checking thread */
+void ThreadZerocoinSpendCheck();
+/** Run an instance of the block header hashing thread */
+void ThreadHeaderHash();
+/** Run an instance of the block reading thread used by the supply recalculation */
+void ThreadSupplyRead();
+/** Hash a batch of block headers, spread over the header hashing threads when there are any.
+ *  Each header keeps its hash memoized, so later GetHash() calls on it are free. */
+void HashBlockHeaders(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<uint256>& vHashes);
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -351,12 +383,15 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
+/** Run zerocoin spend proof checks, spread over the zerocoin check threads when there are any */
+bool RunZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks);
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
 bool BlockToPubcoinList(const CBlock& block, list<libzerocoin::PublicCoin>& listPubcoins);
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, list<libzerocoin::PublicCoin>& listPubcoins, libzerocoin::CoinDenomination denom = libzerocoin::ZQ_ERROR);
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints);
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vValues);
 std::list<libzerocoin::CoinDenomination> ZerocoinSpendListFromBlock(const CBlock& block);
@@ -442,11 +477,136 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof verification of one zerocoin spend input
+ * (accumulator membership and serial number signature of knowledge). These
+ * dominate block validation time, so they are deferred and run on the check
+ * queue, letting all spends of a block or transaction verify in parallel.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    CTxIn txin;
+    uint32_t nAccumulatorChecksum;
+    CBigNum bnAccumulatorValue;
+    bool cacheStore;
+
+public:
+    CZerocoinSpendCheck() : nAccumulatorChecksum(0), cacheStore(false) {}
+    CZerocoinSpendCheck(const CTxIn& txinIn, uint32_t nAccumulatorChecksumIn, const CBigNum& bnAccumulatorValueIn, bool cacheIn) : txin(txinIn), nAccumulatorChecksum(nAccumulatorChecksumIn),
+                                                                                                                                   bnAccumulatorValue(bnAccumulatorValueIn), cacheStore(cacheIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(txin, check.txin);
+        std::swap(nAccumulatorChecksum, check.nAccumulatorChecksum);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+        std::swap(cacheStore, check.cacheStore);
+    }
+};
+
+//! Which block index fields a supply recalculation pass rewrites
+enum SupplyRecalculation {
+    RECALC_ZUMB_MINTED = 1,
+    RECALC_ZUMB_SPENT = 2,
+    RECALC_UMB_SUPPLY = 4,
+};
+
+/** Values of one block needed to recalculate the supply fields of its index */
+class CSupplyBlockData
+{
+public:
+    CAmount nValueIn;
+    CAmount nValueOut;
+    CZerocoinMintCounts mints;
+    std::list<libzerocoin::CoinDenomination> listSpends;
+    //! inputs whose value could not be taken from the undo data
+    std::vector<COutPoint> vPrevoutsMissing;
+    //! the pubcoin index did not have the block, its pubcoins are decoded into listPubcoins to be indexed
+    bool fPubcoinsFromBlock;
+    std::list<libzerocoin::PublicCoin> listPubcoins;
+
+    CSupplyBlockData() : nValueIn(0), nValueOut(0), fPubcoinsFromBlock(false) {}
+};
+
+/**
+ * Closure representing reading and decoding one block (and its undo data) for a
+ * supply recalculation, so that the disk reads and deserialization of a batch of
+ * blocks are spread over the supply reading threads. The positions and hashes are
+ * taken from the block index by the caller under cs_main.
+ */
+class CSupplyReadCheck
+{
+private:
+    CDiskBlockPos posBlock;
+    CDiskBlockPos posUndo;
+    uint256 hashBlock;
+    uint256 hashPrevBlock;
+    int nHeight;
+    int nFlags;
+    bool fMintsFromBlock;
+    CSupplyBlockData* pdata;
+
+public:
+    CSupplyReadCheck() : nHeight(0), nFlags(0), fMintsFromBlock(false), pdata(NULL) {}
+    CSupplyReadCheck(const CDiskBlockPos& posBlockIn, const CDiskBlockPos& posUndoIn, const uint256& hashBlockIn, const uint256& hashPrevBlockIn,
+                     int nHeightIn, int nFlagsIn, bool fMintsFromBlockIn, CSupplyBlockData* pdataIn) : posBlock(posBlockIn), posUndo(posUndoIn), hashBlock(hashBlockIn), hashPrevBlock(hashPrevBlockIn),
+                                                                                                        nHeight(nHeightIn), nFlags(nFlagsIn), fMintsFromBlock(fMintsFromBlockIn), pdata(pdataIn) {}
+
+    bool operator()();
+
+    void swap(CSupplyReadCheck& check)
+    {
+        std::swap(posBlock, check.posBlock);
+        std::swap(posUndo, check.posUndo);
+        std::swap(hashBlock, check.hashBlock);
+        std::swap(hashPrevBlock, check.hashPrevBlock);
+        std::swap(nHeight, check.nHeight);
+        std::swap(nFlags, check.nFlags);
+        std::swap(fMintsFromBlock, check.fMintsFromBlock);
+        std::swap(pdata, check.pdata);
+    }
+};
+
+/** Read the blocks of a supply recalculation, spread over the supply reading threads when there are any */
+bool RunSupplyReadChecks(std::vector<CSupplyReadCheck>& vChecks);
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block as stored, checking only the magic, size and header hash in front of the transactions */
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CBlockIndex* pindex);
+/** The serialized block for pindex, from the cache of recently served blocks or else from disk */
+bool GetRawBlock(const CBlockIndex* pindex, std::shared_ptr<const CDataStream>& pssBlock);
+
+/**
+ * Blocks recently served to peers and REST/RPC clients, kept as stored on disk. Peers syncing
+ * from us ask for the same stretch of chain one after another, so most of them share one read.
+ * The least recently served blocks are dropped once the cache holds more than nMaxSize bytes.
+ */
+class CRawBlockCache
+{
+private:
+    typedef std::list<std::pair<uint256, std::shared_ptr<const CDataStream> > > BlockList;
+
+    CCriticalSection cs;
+    BlockList listBlocks; //! most recently served first
+    std::map<uint256, BlockList::iterator> mapBlocks;
+    size_t nSize;
+    size_t nMaxSize;
+
+public:
+    CRawBlockCache(size_t nMaxSizeIn) : nSize(0), nMaxSize(nMaxSizeIn) {}
+
+    bool Get(const uint256& hash, std::shared_ptr<const CDataStream>& pssBlock);
+    void Insert(const uint256& hash, const std::shared_ptr<const CDataStream>& pssBlock);
+    //! Bytes of serialized blocks held
+    size_t GetSize();
+};
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -466,7 +626,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
+bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev, bool fCheckStake = true);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev);
@@ -477,7 +637,8 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+/** Add a header to the block index; phash, when given, is its already computed hash */
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL, const uint256* phash = NULL);
 
 
 class CBlockFileInfo
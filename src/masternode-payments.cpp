@@ -457,8 +457,6 @@ bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payee)
 // -- Only look ahead up to 8 blocks to allow for propagation of the latest 2 winners
 bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
 {
-    LOCK(cs_mapMasternodeBlocks);
-
     int nHeight;
     {
         TRY_LOCK(cs_main, locked);
@@ -469,16 +467,20 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
     CScript mnpayee;
     mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
 
-    CScript payee;
-    for (int64_t h = nHeight; h <= nHeight + 8; h++) {
-        if (h == nNotBlockHeight) continue;
-        if (mapMasternodeBlocks.count(h)) {
-            if (mapMasternodeBlocks[h].GetPayee(payee)) {
-                if (mnpayee == payee) {
-                    return true;
-                }
-            }
-        }
+    return IsScheduled(mnpayee, nHeight, nNotBlockHeight);
+}
+
+// Same as above for a known payee script and chain height, without touching cs_main
+bool CMasternodePayments::IsScheduled(const CScript& payee, int nHeight, int nNotBlockHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator mi = mapPayeeScheduledHeights.find(payee);
+    if (mi == mapPayeeScheduledHeights.end()) return false;
+
+    std::set<int>::const_iterator it = mi->second.lower_bound(nHeight);
+    for (; it != mi->second.end() && *it <= nHeight + 8; ++it) {
+        if (*it != nNotBlockHeight) return true;
     }
 
     return false;
@@ -504,13 +506,95 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
             CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        if (mapMasternodeBlocks[winnerIn.nBlockHeight].HasPayeeWithVotes(winnerIn.payee, 2))
+            AddPayeeVotedHeight(winnerIn.payee, winnerIn.nBlockHeight);
+        UpdateScheduledPayee(winnerIn.nBlockHeight);
+    }
 
     return true;
 }
 
+void CMasternodePayments::AddPayeeVotedHeight(const CScript& payee, int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+    mapPayeeVotedHeights[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::RemovePayeeVotedHeights(int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it == mapMasternodeBlocks.end()) return;
+
+    LOCK(cs_vecPayments);
+    BOOST_FOREACH (CMasternodePayee& p, it->second.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator mi = mapPayeeVotedHeights.find(p.scriptPubKey);
+        if (mi == mapPayeeVotedHeights.end()) continue;
+        mi->second.erase(nBlockHeight);
+        if (mi->second.empty()) mapPayeeVotedHeights.erase(mi);
+    }
+}
+
+// Keep mapScheduledPayee and mapPayeeScheduledHeights in step with GetBlockPayee for nBlockHeight
+void CMasternodePayments::UpdateScheduledPayee(int nBlockHeight)
+{
+    AssertLockHeld(cs_mapMasternodeBlocks);
+
+    CScript payee;
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    bool fHasPayee = it != mapMasternodeBlocks.end() && it->second.GetPayee(payee);
+
+    std::map<int, CScript>::iterator si = mapScheduledPayee.find(nBlockHeight);
+    if (si != mapScheduledPayee.end()) {
+        if (fHasPayee && si->second == payee) return;
+
+        std::map<CScript, std::set<int> >::iterator mi = mapPayeeScheduledHeights.find(si->second);
+        if (mi != mapPayeeScheduledHeights.end()) {
+            mi->second.erase(nBlockHeight);
+            if (mi->second.empty()) mapPayeeScheduledHeights.erase(mi);
+        }
+        mapScheduledPayee.erase(si);
+    }
+
+    if (fHasPayee) {
+        mapScheduledPayee[nBlockHeight] = payee;
+        mapPayeeScheduledHeights[payee].insert(nBlockHeight);
+    }
+}
+
+void CMasternodePayments::RebuildPayeeIndexes()
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_vecPayments);
+
+    mapPayeeVotedHeights.clear();
+    mapScheduledPayee.clear();
+    mapPayeeScheduledHeights.clear();
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.begin();
+    while (it != mapMasternodeBlocks.end()) {
+        BOOST_FOREACH (CMasternodePayee& p, it->second.vecPayments) {
+            if (p.nVotes >= 2) mapPayeeVotedHeights[p.scriptPubKey].insert(it->first);
+        }
+        UpdateScheduledPayee(it->first);
+        ++it;
+    }
+}
+
+// Highest height not above nMaxHeight at which payee has at least 2 votes, or 0 if none
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nMaxHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator mi = mapPayeeVotedHeights.find(payee);
+    if (mi == mapPayeeVotedHeights.end()) return 0;
+
+    std::set<int>::const_iterator it = mi->second.upper_bound(nMaxHeight);
+    if (it == mi->second.begin()) return 0;
+    return *(--it);
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -638,7 +722,9 @@ void CMasternodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
             mapMasternodePayeeVotes.erase(it++);
+            RemovePayeeVotedHeights(winner.nBlockHeight);
             mapMasternodeBlocks.erase(winner.nBlockHeight);
+            UpdateScheduledPayee(winner.nBlockHeight);
         } else {
             ++it;
         }
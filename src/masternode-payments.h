@@ -236,6 +236,17 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    // heights at which each payee has at least 2 votes, for last paid lookups
+    std::map<CScript, std::set<int> > mapPayeeVotedHeights;
+    // current winning payee of each block and its reverse, for schedule lookups
+    std::map<int, CScript> mapScheduledPayee;
+    std::map<CScript, std::set<int> > mapPayeeScheduledHeights;
+
+    void AddPayeeVotedHeight(const CScript& payee, int nBlockHeight);
+    void RemovePayeeVotedHeights(int nBlockHeight);
+    void UpdateScheduledPayee(int nBlockHeight);
+    void RebuildPayeeIndexes();
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -252,6 +263,9 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeVotedHeights.clear();
+        mapScheduledPayee.clear();
+        mapPayeeScheduledHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -260,10 +274,12 @@ public:
     void Sync(CNode* node, int nCountNeeded);
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
+    int GetLastPaidHeight(const CScript& payee, int nMaxHeight);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
+    bool IsScheduled(const CScript& payee, int nHeight, int nNotBlockHeight);
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight)
     {
@@ -295,6 +311,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPayeeIndexes();
     }
 };
 
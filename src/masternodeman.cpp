@@ -26,19 +26,11 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-        const pair<int64_t, CTxIn>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
-struct CompareScoreMN {
-    bool operator()(const pair<int64_t, CMasternode>& t1,
-        const pair<int64_t, CMasternode>& t2) const
+struct CompareScoreDescending {
+    bool operator()(const pair<int64_t, int>& t1,
+        const pair<int64_t, int>& t2) const
     {
-        return t1.first < t2.first;
+        return t1.first > t2.first;
     }
 };
 
@@ -196,6 +188,7 @@ void DumpMasternodes()
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    fCollateralsDirty = true;
 }
 
 bool CMasternodeMan::Add(CMasternode& mn)
@@ -209,6 +202,8 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        mapMasternodeScores.clear();
+        fCollateralsDirty = true;
         return true;
     }
 
@@ -240,6 +235,46 @@ void CMasternodeMan::Check()
     }
 }
 
+void CMasternodeMan::CheckCollaterals()
+{
+    LOCK2(cs_main, cs);
+
+    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+        if (mn.activeState == CMasternode::MASTERNODE_VIN_SPENT) continue;
+
+        const COutPoint& prevout = mn.vin.prevout;
+        const CCoins* coins = pcoinsTip->AccessCoins(prevout.hash);
+        if (coins == NULL || !coins->IsAvailable(prevout.n) || mempool.mapNextTx.count(prevout)) {
+            LogPrint("masternode", "CMasternodeMan::CheckCollaterals - Masternode %s collateral is spent\n", prevout.ToStringShort());
+            mn.activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        }
+    }
+}
+
+void CMasternodeMan::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    if (tx.IsCoinBase() || tx.IsZerocoinSpend()) return;
+
+    LOCK(cs);
+
+    if (fCollateralsDirty) {
+        setCollaterals.clear();
+        BOOST_FOREACH (CMasternode& mn, vMasternodes)
+            setCollaterals.insert(mn.vin.prevout);
+        fCollateralsDirty = false;
+    }
+
+    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        if (!setCollaterals.count(txin.prevout)) continue;
+
+        BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+            if (mn.vin.prevout != txin.prevout || mn.activeState == CMasternode::MASTERNODE_VIN_SPENT) continue;
+            LogPrint("masternode", "CMasternodeMan::SyncTransaction - Masternode %s collateral spent by %s\n", txin.prevout.ToStringShort(), tx.GetHash().ToString());
+            mn.activeState = CMasternode::MASTERNODE_VIN_SPENT;
+        }
+    }
+}
+
 void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
 {
     Check();
@@ -279,6 +314,8 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            mapMasternodeScores.clear();
+            fCollateralsDirty = true;
         } else {
             ++it;
         }
@@ -340,6 +377,8 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapMasternodeScores.clear();
+    fCollateralsDirty = true;
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -486,6 +525,11 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     */
 
     int nMnCount = CountEnabled();
+    int nTipHeight = -1;
+    {
+        TRY_LOCK(cs_main, locked);
+        if (locked && chainActive.Tip() != NULL) nTipHeight = chainActive.Tip()->nHeight;
+    }
     BOOST_FOREACH (CMasternode& mn, vMasternodes) {
         mn.Check();
         if (!mn.IsEnabled()) continue;
@@ -494,7 +538,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         if (mn.protocolVersion < masternodePayments.GetMinMasternodePaymentsProto()) continue;
 
         //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if (masternodePayments.IsScheduled(mn, nBlockHeight)) continue;
+        if (nTipHeight >= 0 && masternodePayments.IsScheduled(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()), nTipHeight, nBlockHeight)) continue;
 
         //it's too new, wait for a cycle
         if (fFilterSigTime && mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime()) continue;
@@ -502,7 +546,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nMnCount), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -517,6 +561,9 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
+    const CMasternodeScores* pscores = GetMasternodeScores(nBlockHeight - 100);
+    if (!pscores) return NULL;
+
     int nTenthNetwork = CountEnabled() / 10;
     int nCountTenth = 0;
     uint256 nHigh = 0;
@@ -524,7 +571,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         CMasternode* pmn = Find(s.second);
         if (!pmn) break;
 
-        uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
+        uint256 n = pscores->vScore[pmn - &vMasternodes[0]];
         if (n > nHigh) {
             nHigh = n;
             pBestMasternode = pmn;
@@ -567,23 +614,65 @@ CMasternode* CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude
     return NULL;
 }
 
+const CMasternodeMan::CMasternodeScores* CMasternodeMan::GetMasternodeScores(int64_t nBlockHeight)
+{
+    AssertLockHeld(cs);
+
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    std::map<int64_t, CMasternodeScores>::iterator it = mapMasternodeScores.find(nBlockHeight);
+    if (it != mapMasternodeScores.end() && it->second.hashBlock == hash)
+        return &it->second;
+
+    if (it == mapMasternodeScores.end()) {
+        if (mapMasternodeScores.size() >= MASTERNODES_SCORE_CACHE_SIZE)
+            mapMasternodeScores.erase(mapMasternodeScores.begin());
+        it = mapMasternodeScores.insert(make_pair(nBlockHeight, CMasternodeScores())).first;
+    }
+
+    CMasternodeScores& scores = it->second;
+    scores.hashBlock = hash;
+    scores.vScore.resize(vMasternodes.size());
+    scores.vScoreCompact.resize(vMasternodes.size());
+    std::vector<pair<int64_t, int> > vecScores;
+    vecScores.reserve(vMasternodes.size());
+    for (unsigned int i = 0; i < vMasternodes.size(); i++) {
+        scores.vScore[i] = vMasternodes[i].CalculateScore(1, nBlockHeight);
+        scores.vScoreCompact[i] = scores.vScore[i].GetCompact(false);
+        vecScores.push_back(make_pair(scores.vScoreCompact[i], (int)i));
+    }
+
+    // high to low, ties in list order
+    std::stable_sort(vecScores.begin(), vecScores.end(), CompareScoreDescending());
+    scores.vRanked.clear();
+    scores.vRanked.reserve(vecScores.size());
+    BOOST_FOREACH (PAIRTYPE(int64_t, int) & s, vecScores)
+        scores.vRanked.push_back(s.second);
+
+    return &scores;
+}
+
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
+    LOCK(cs);
+
     int64_t score = 0;
     CMasternode* winner = NULL;
 
+    const CMasternodeScores* pscores = GetMasternodeScores(nBlockHeight);
+    if (!pscores) return NULL;
+
     // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    for (unsigned int i = 0; i < vMasternodes.size(); i++) {
+        CMasternode& mn = vMasternodes[i];
         mn.Check();
         if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
 
-        // calculate the score for each Masternode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
         // determine the winner
-        if (n2 > score) {
-            score = n2;
+        if (pscores->vScoreCompact[i] > score) {
+            score = pscores->vScoreCompact[i];
             winner = &mn;
         }
     }
@@ -593,16 +682,18 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
+
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    const CMasternodeScores* pscores = GetMasternodeScores(nBlockHeight);
+    if (!pscores) return -1;
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    // walk the masternodes from the highest score down, counting the ones that qualify
+    int rank = 0;
+    BOOST_FOREACH (int i, pscores->vRanked) {
+        CMasternode& mn = vMasternodes[i];
         if (mn.protocolVersion < minProtocol) {
             LogPrint("masternode","Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
             continue;                                                       // Skip obsolete versions
@@ -619,18 +710,9 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
+        if (mn.vin.prevout == vin.prevout) {
             return rank;
         }
     }
@@ -640,36 +722,36 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
 std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<pair<int64_t, CMasternode> > vecMasternodeScores;
+    LOCK(cs);
+
+    std::vector<pair<int64_t, int> > vecMasternodeScores;
     std::vector<pair<int, CMasternode> > vecMasternodeRanks;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    const CMasternodeScores* pscores = GetMasternodeScores(nBlockHeight);
+    if (!pscores) return vecMasternodeRanks;
 
     // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    BOOST_FOREACH (int i, pscores->vRanked) {
+        CMasternode& mn = vMasternodes[i];
         mn.Check();
 
         if (mn.protocolVersion < minProtocol) continue;
 
         if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(make_pair(9999, mn));
+            vecMasternodeScores.push_back(make_pair(9999, i));
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn));
+        vecMasternodeScores.push_back(make_pair(pscores->vScoreCompact[i], i));
     }
 
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+    // only the disabled masternodes move, down among the lowest scores
+    std::stable_sort(vecMasternodeScores.begin(), vecMasternodeScores.end(), CompareScoreDescending());
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode) & s, vecMasternodeScores) {
+    BOOST_FOREACH (PAIRTYPE(int64_t, int) & s, vecMasternodeScores) {
         rank++;
-        vecMasternodeRanks.push_back(make_pair(rank, s.second));
+        vecMasternodeRanks.push_back(make_pair(rank, vMasternodes[s.second]));
     }
 
     return vecMasternodeRanks;
@@ -677,29 +759,23 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode& mn, vMasternodes) {
+    const CMasternodeScores* pscores = GetMasternodeScores(nBlockHeight);
+    if (!pscores) return NULL;
+
+    int rank = 0;
+    BOOST_FOREACH (int i, pscores->vRanked) {
+        CMasternode& mn = vMasternodes[i];
         if (mn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecMasternodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &mn;
         }
     }
 
@@ -1140,6 +1216,8 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            mapMasternodeScores.clear();
+            fCollateralsDirty = true;
             break;
         }
         ++it;
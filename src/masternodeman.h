@@ -13,9 +13,11 @@
 #include "net.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
 
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODES_SCORE_CACHE_SIZE 256
 
 using namespace std;
 
@@ -48,7 +50,7 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
-class CMasternodeMan
+class CMasternodeMan : public CValidationInterface
 {
 private:
     // critical section to protect the inner data structures
@@ -66,6 +68,29 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // scores of the masternodes in vMasternodes for one block height
+    struct CMasternodeScores {
+        uint256 hashBlock;
+        // score and its compact form, by position in vMasternodes
+        std::vector<uint256> vScore;
+        std::vector<int64_t> vScoreCompact;
+        // positions in vMasternodes from the highest compact score down
+        std::vector<int> vRanked;
+    };
+    // scores by block height, dropped whenever vMasternodes changes
+    std::map<int64_t, CMasternodeScores> mapMasternodeScores;
+
+    /// Get the scores of all masternodes for a block height, computing them if needed
+    const CMasternodeScores* GetMasternodeScores(int64_t nBlockHeight);
+
+    // collateral outpoints of vMasternodes, rebuilt on the next lookup after vMasternodes changes
+    std::set<COutPoint> setCollaterals;
+    bool fCollateralsDirty;
+
+protected:
+    // mark masternodes whose collateral is spent by a transaction entering the mempool or a block
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -82,6 +107,10 @@ public:
     {
         LOCK(cs);
         READWRITE(vMasternodes);
+        if (ser_action.ForRead()) {
+            mapMasternodeScores.clear();
+            fCollateralsDirty = true;
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -103,6 +132,9 @@ public:
     /// Check all Masternodes
     void Check();
 
+    /// Mark Masternodes whose collateral is no longer in the UTXO set as spent
+    void CheckCollaterals();
+
     /// Check all Masternodes and remove inactive
     void CheckAndRemove(bool forceExpiredRemoval = false);
 
@@ -36,33 +36,15 @@ using namespace std;
 // UmbraMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
 
+// Packages that fail to fit in a row before giving up on a nearly full block
+static const unsigned int MAX_CONSECUTIVE_FAILURES = 1000;
+
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, const CTxMemPoolEntry*> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -84,6 +66,200 @@ public:
     }
 };
 
+// An ancestor always has fewer in-pool ancestors than any of its descendants
+class AncestorCountCompare
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+    }
+};
+
+bool CBlockAssembler::AddTx(const CTxMemPoolEntry& entry)
+{
+    const CTransaction& tx = entry.GetTx();
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
+
+    if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    if (!view.HaveInputs(tx))
+        return false;
+
+    // double check that there are no double spent zUmbra spends in this block or tx
+    vector<CBigNum> vTxSerials;
+    if (tx.IsZerocoinSpend()) {
+        int nHeightTx = 0;
+        if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+            return false;
+
+        bool fDoubleSerial = false;
+        for (const CTxIn txIn : tx.vin) {
+            if (txIn.scriptSig.IsZerocoinSpend()) {
+                libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+                if (!spend.HasValidSerial(Params().Zerocoin_Params()))
+                    fDoubleSerial = true;
+                if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
+                    fDoubleSerial = true;
+                if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
+                    fDoubleSerial = true;
+                if (fDoubleSerial)
+                    break;
+                vTxSerials.emplace_back(spend.getCoinSerialNumber());
+            }
+        }
+        //This zUmbra serial has already been included in the block, do not add this tx.
+        if (fDoubleSerial)
+            return false;
+    }
+
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+
+    // Added
+    pblocktemplate->block.vtx.push_back(tx);
+    pblocktemplate->vTxFees.push_back(nTxFees);
+    pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    nBlockSize += entry.GetTxSize();
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+    setInBlock.insert(tx.GetHash());
+
+    for (const CBigNum bnSerial : vTxSerials)
+        vBlockSerials.emplace_back(bnSerial);
+
+    if (fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+            entry.GetPriority(nHeight), CFeeRate(entry.GetModifiedFee(), entry.GetTxSize()).ToString(), tx.GetHash().ToString());
+    }
+    return true;
+}
+
+bool CBlockAssembler::AddPackage(const CTxMemPoolEntry& entry, uint64_t nSizeLimit)
+{
+    const uint256& hash = entry.GetTx().GetHash();
+    if (setInBlock.count(hash))
+        return true;
+    if (setFailed.count(hash))
+        return false;
+
+    set<uint256> setAncestors;
+    pool.CalculateAncestors(entry.GetTx(), setAncestors);
+    vector<const CTxMemPoolEntry*> vPackage;
+    uint64_t nPackageSize = entry.GetTxSize();
+    BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+        if (setInBlock.count(hashAncestor))
+            continue;
+        // Cannot go in without a parent that failed
+        if (setFailed.count(hashAncestor)) {
+            setFailed.insert(hash);
+            return false;
+        }
+        const CTxMemPoolEntry& ancestor = pool.mapTx.find(hashAncestor)->second;
+        vPackage.push_back(&ancestor);
+        nPackageSize += ancestor.GetTxSize();
+    }
+    if (nBlockSize + nPackageSize >= nSizeLimit)
+        return false;
+
+    std::sort(vPackage.begin(), vPackage.end(), AncestorCountCompare());
+    vPackage.push_back(&entry);
+    BOOST_FOREACH (const CTxMemPoolEntry* pentry, vPackage) {
+        if (!AddTx(*pentry)) {
+            setFailed.insert(pentry->GetTx().GetHash());
+            setFailed.insert(hash);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CBlockAssembler::AddPriorityTxs(unsigned int nBlockPrioritySize)
+{
+    // Priority grows with the chain height at a different rate for each transaction, so unlike fee rate
+    // the pool cannot keep it sorted; this is the only pass over the whole pool, and it is skipped when
+    // the priority area is disabled
+    if (nBlockPrioritySize == 0)
+        return;
+
+    vector<TxPriority> vecPriority;
+    for (map<uint256, CTxMemPoolEntry>::const_iterator mi = pool.mapTx.begin(); mi != pool.mapTx.end(); ++mi) {
+        double dPriority = mi->second.GetPriority(nHeight);
+        CAmount nFeeDelta = 0;
+        pool.ApplyDeltas(mi->first, dPriority, nFeeDelta);
+        if (AllowFree(dPriority))
+            vecPriority.push_back(TxPriority(dPriority, CFeeRate(mi->second.GetModifiedFee(), mi->second.GetTxSize()), &mi->second));
+    }
+    std::sort(vecPriority.begin(), vecPriority.end(), TxPriorityCompare(false));
+
+    for (vector<TxPriority>::reverse_iterator it = vecPriority.rbegin(); it != vecPriority.rend(); ++it) {
+        if (nBlockSize >= nBlockPrioritySize)
+            break;
+        AddPackage(*it->get<2>(), nBlockPrioritySize);
+    }
+}
+
+void CBlockAssembler::AddPackagesByScore(unsigned int nBlockMaxSize, unsigned int nBlockMinSize)
+{
+    // From the top of the pool's ancestor score index until the block is full or only free packages are left
+    unsigned int nConsecutiveFailed = 0;
+    std::set<std::pair<double, uint256> >::const_reverse_iterator it = pool.setByAncestorScore.rbegin();
+    for (; it != pool.setByAncestorScore.rend(); ++it) {
+        if (IsInBlock(it->second))
+            continue;
+        const CTxMemPoolEntry& entry = pool.mapTx.find(it->second)->second;
+        bool fZerocoinSpend = entry.GetTx().IsZerocoinSpend();
+
+        // Free transactions only fill the block up to the minimum block size, everything below them pays less
+        uint64_t nPackageSize = entry.GetSizeWithAncestors();
+        if (!fZerocoinSpend && CFeeRate(entry.GetFeesWithAncestors(), nPackageSize) < ::minRelayTxFee) {
+            if (nBlockSize >= nBlockMinSize)
+                break;
+            if (nBlockSize + nPackageSize >= nBlockMinSize) {
+                if (++nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES)
+                    break;
+                continue;
+            }
+        }
+
+        if (AddPackage(entry, nBlockMaxSize)) {
+            nConsecutiveFailed = 0;
+        } else if (++nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize + 4000 > nBlockMaxSize) {
+            // Nearly full and nothing left seems to fit
+            return;
+        }
+    }
+
+    // Zerocoin spends are taken whatever their fee rate, the pool keeps them apart so the free tail of
+    // the score index is never walked for them
+    BOOST_FOREACH (const uint256& hash, pool.setZerocoinSpends) {
+        if (!IsInBlock(hash))
+            AddPackage(pool.mapTx.find(hash)->second, nBlockMaxSize);
+    }
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -179,212 +355,12 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-
-            if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-                    break;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
+        CBlockAssembler assembler(pblocktemplate.get(), mempool, view, nHeight, GetBoolArg("-printpriority", false));
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.IsZerocoinSpend() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent zUmbra spends in this block or tx
-            if (tx.IsZerocoinSpend()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn txIn : tx.vin) {
-                    if (txIn.scriptSig.IsZerocoinSpend()) {
-                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                        if (!spend.HasValidSerial(Params().Zerocoin_Params()))
-                            fDoubleSerial = true;
-                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend.getCoinSerialNumber());
-                    }
-                }
-                //This zUmbra serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        // High priority transactions first, up to -blockprioritysize, then the rest by fee rate
+        assembler.AddPriorityTxs(nBlockPrioritySize);
+        assembler.AddPackagesByScore(nBlockMaxSize, nBlockMinSize);
+        nFees = assembler.nFees;
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -396,9 +372,9 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
             }
         }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        nLastBlockTx = assembler.nBlockTx;
+        nLastBlockSize = assembler.nBlockSize;
+        LogPrintf("CreateNewBlock(): total size %u\n", assembler.nBlockSize);
 
         // Compute final coinbase transaction.
         if (!fProofOfStake) {
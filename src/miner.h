@@ -6,17 +6,75 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
+#include "libzerocoin/bignum.h"
+#include "uint256.h"
+
+#include <set>
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
 class CBlockIndex;
+class CCoinsViewCache;
 class CReserveKey;
 class CScript;
+class CTxMemPool;
+class CTxMemPoolEntry;
 class CWallet;
 
 struct CBlockTemplate;
 
+/**
+ * Unconfirmed transactions in the memory pool often depend on other
+ * transactions in the memory pool. CBlockAssembler adds a transaction
+ * together with whatever it spends from the pool that is not in the block
+ * yet, parents first, so that picking candidates straight off the pool's
+ * ancestor score index never needs a pass over the whole pool.
+ */
+class CBlockAssembler
+{
+private:
+    CBlockTemplate* pblocktemplate;
+    CTxMemPool& pool;
+    CCoinsViewCache& view;
+    const int nHeight;
+    const bool fPrintPriority;
+
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
+    std::vector<CBigNum> vBlockSerials;
+
+    bool AddTx(const CTxMemPoolEntry& entry);
+
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+
+    /** Requires cs_main and pool.cs for as long as it is in use */
+    CBlockAssembler(CBlockTemplate* pblocktemplateIn, CTxMemPool& poolIn, CCoinsViewCache& viewIn, int nHeightIn, bool fPrintPriorityIn)
+        : pblocktemplate(pblocktemplateIn), pool(poolIn), view(viewIn), nHeight(nHeightIn), fPrintPriority(fPrintPriorityIn),
+          nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
+    {
+    }
+
+    bool IsInBlock(const uint256& hash) const { return setInBlock.count(hash) != 0; }
+
+    /** Add entry and its ancestors that are not in the block yet, keeping the block below nSizeLimit.
+     *  Returns false if the package does not fit or any of it fails to validate */
+    bool AddPackage(const CTxMemPoolEntry& entry, uint64_t nSizeLimit);
+
+    /** Add the highest priority transactions, free ones included, until the block reaches nBlockPrioritySize */
+    void AddPriorityTxs(unsigned int nBlockPrioritySize);
+
+    /** Fill the rest of the block by ancestor fee rate. Free transactions only go in below nBlockMinSize,
+     *  zerocoin spends, which carry no fee, always do */
+    void AddPackagesByScore(unsigned int nBlockMaxSize, unsigned int nBlockMinSize);
+};
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
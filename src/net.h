@@ -21,6 +21,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <set>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -75,7 +76,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhitelisted = false);
-void StartNode(boost::thread_group& threadGroup);
+bool StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
@@ -224,6 +225,7 @@ public:
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
+    bool fSendInterest; // socket registered for write readiness, only while vSendMsg is not empty
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -648,6 +650,25 @@ public:
     static uint64_t GetTotalBytesSent();
 };
 
+#ifdef USE_EPOLL
+/**
+ * Nodes that epoll reported ready but that have not been fully serviced yet.
+ * Edge-triggered readiness is only reported once, so a node stays here until
+ * a send or a short read drains its socket, or until the node is deleted.
+ */
+class CNodeReadiness
+{
+public:
+    std::set<CNode*> setReadable;
+    std::set<CNode*> setWritable;
+
+    void MarkReady(CNode* pnode, uint32_t nEvents);
+    void Forget(CNode* pnode);
+    bool IsIdle() const { return setReadable.empty() && setWritable.empty(); }
+    void Clear();
+};
+#endif
+
 class CExplicitNetCleanup
 {
 public:
@@ -13,12 +13,60 @@
 #include "utilstrencodings.h"
 #include "util.h"
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! Guards the memoized hash of every header; held only to compare and copy it, never while hashing
+static boost::mutex& HeaderHashMutex()
+{
+    // function local so that headers hashed during static initialization (genesis blocks) find it constructed
+    static boost::mutex cs_headerhash;
+    return cs_headerhash;
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+    if (this == &other)
+        return *this;
+
+    nVersion = other.nVersion;
+    hashPrevBlock = other.hashPrevBlock;
+    hashMerkleRoot = other.hashMerkleRoot;
+    nTime = other.nTime;
+    nBits = other.nBits;
+    nNonce = other.nNonce;
+    nAccumulatorCheckpoint = other.nAccumulatorCheckpoint;
+
+    boost::lock_guard<boost::mutex> lock(HeaderHashMutex());
+    hashCached = other.hashCached;
+    memcpy(vchHashedHeader, other.vchHashedHeader, HEADER_HASHED_SIZE);
+    fHashCached = other.fHashCached;
+    return *this;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
+    // Header fields are public and get changed in place (nonce grinding, template updates),
+    // so the memoized hash is only valid while the bytes it was computed from are unchanged.
+    unsigned char vchHeader[HEADER_HASHED_SIZE];
+    memcpy(vchHeader, BEGIN(nVersion), HEADER_HASHED_SIZE);
+    {
+        boost::lock_guard<boost::mutex> lock(HeaderHashMutex());
+        if (fHashCached && memcmp(vchHashedHeader, vchHeader, HEADER_HASHED_SIZE) == 0)
+            return hashCached;
+    }
+
+    uint256 hash;
 	if(nVersion < 4)
-        return XEVAN(BEGIN(nVersion), END(nNonce));
+        hash = XEVAN(BEGIN(nVersion), END(nNonce));
+    else
+        hash = Hash(BEGIN(nVersion), END(nAccumulatorCheckpoint));
 
-    return Hash(BEGIN(nVersion), END(nAccumulatorCheckpoint));
+    boost::lock_guard<boost::mutex> lock(HeaderHashMutex());
+    hashCached = hash;
+    memcpy(vchHashedHeader, vchHeader, HEADER_HASHED_SIZE);
+    fHashCached = true;
+    return hash;
 }
 
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
@@ -28,6 +28,8 @@ class CBlockHeader
 public:
     // header
     static const int32_t CURRENT_VERSION=4;
+    //! Bytes from nVersion to nAccumulatorCheckpoint, the widest range any header version hashes
+    static const size_t HEADER_HASHED_SIZE = 4 + 32 + 32 + 4 + 4 + 4 + 32;
     int32_t nVersion;
     uint256 hashPrevBlock;
     uint256 hashMerkleRoot;
@@ -36,11 +38,27 @@ public:
     uint32_t nNonce;
     uint256 nAccumulatorCheckpoint;
 
+private:
+    // memory only: memoized GetHash() and the header bytes it was computed from, guarded by
+    // a lock because the same header gets hashed from several threads through a const reference
+    mutable uint256 hashCached;
+    mutable unsigned char vchHashedHeader[HEADER_HASHED_SIZE];
+    mutable bool fHashCached;
+
+public:
     CBlockHeader()
     {
         SetNull();
     }
 
+    CBlockHeader(const CBlockHeader& other)
+    {
+        *this = other;
+    }
+
+    //! Copies the header fields and, under the memo lock, the memoized hash
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -67,6 +85,7 @@ public:
         nBits = 0;
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -74,6 +93,7 @@ public:
         return (nBits == 0);
     }
 
+    /** Block hash, computed once and reused until one of the header fields changes */
     uint256 GetHash() const;
 
     int64_t GetBlockTime() const
@@ -98,7 +98,7 @@ void ZUmbraControlDialog::updateList()
             
             int nHeight2CheckpointsDeep = nBestHeight - (nBestHeight % 10) - 20;
             while (pindex->nHeight < nHeight2CheckpointsDeep) { // 20 just to make sure that its at least 2 checkpoints from the top block
-                nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), mint.GetDenomination());
+                nMintsAdded += pindex->mintsInBlock.Count(mint.GetDenomination());
                 if(nMintsAdded >= Params().Zerocoin_RequiredAccumulation())
                     break;
                 pindex = chainActive[pindex->nHeight + 1];
@@ -93,7 +93,7 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDe
 
     Object zumbraObj;
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        zumbraObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        zumbraObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->zerocoinSupply.at(denom) * (denom*COIN))));
     }
     zumbraObj.emplace_back(Pair("total", ValueFromAmount(blockindex->GetZerocoinSupply())));
     result.emplace_back(Pair("zUMBsupply", zumbraObj));
@@ -307,19 +307,21 @@ Value getblock(const Array& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
     if (!fVerbose) {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+        // The block as stored is already what we would serialize
+        std::shared_ptr<const CDataStream> pssBlock;
+        if (!GetRawBlock(pblockindex, pssBlock))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        std::string strHex = HexStr(pssBlock->begin(), pssBlock->end());
         return strHex;
     }
 
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
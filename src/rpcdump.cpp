@@ -120,7 +120,9 @@ Value importprivkey(const Array& params, bool fHelp)
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
+    CBlockIndex* pindexGenesis;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
@@ -135,12 +137,13 @@ Value importprivkey(const Array& params, bool fHelp)
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
-
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-        }
+        pindexGenesis = chainActive.Genesis();
     }
 
+    // the rescan takes cs_main only between batches of blocks
+    if (fRescan)
+        pwalletMain->ScanForWalletTransactions(pindexGenesis, true);
+
     return Value::null;
 }
 
@@ -182,7 +185,9 @@ Value importaddress(const Array& params, bool fHelp)
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
+    CBlockIndex* pindexGenesis;
     {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
@@ -198,11 +203,13 @@ Value importaddress(const Array& params, bool fHelp)
 
         if (!pwalletMain->AddWatchOnly(script))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+        pindexGenesis = chainActive.Genesis();
+    }
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+    // the rescan takes cs_main only between batches of blocks
+    if (fRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexGenesis, true);
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return Value::null;
@@ -111,7 +111,7 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("moneysupply",ValueFromAmount(chainActive.Tip()->nMoneySupply)));
     Object zumbraObj;
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        zumbraObj.push_back(Pair(to_string(denom), ValueFromAmount(chainActive.Tip()->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        zumbraObj.push_back(Pair(to_string(denom), ValueFromAmount(chainActive.Tip()->zerocoinSupply.at(denom) * (denom*COIN))));
     }
     zumbraObj.emplace_back(Pair("total", ValueFromAmount(chainActive.Tip()->GetZerocoinSupply())));
     obj.emplace_back(Pair("zUMBsupply", zumbraObj));
@@ -2755,6 +2755,7 @@ Value importzerocoins(const Array& params, bool fHelp)
         mint.SetTxHash(txid);
         mint.SetHeight(nHeight);
         walletdb.WriteZerocoinMint(mint);
+        pwalletMain->AddZerocoinMint(mint);
         count++;
         nValue += libzerocoin::ZerocoinDenominationToAmount(denom);
     }
@@ -34,6 +34,8 @@ using namespace libzerocoin;
 #define COLOR_STR_RED     "\033[31m"
 
 #define TESTS_COINS_TO_ACCUMULATE   50
+#define TESTS_SPENDS_TO_BENCHMARK   5
+#define TESTS_COMMITMENTS_TO_BENCHMARK 200
 
 // Global test counters
 uint32_t    ggNumTests        = 0;
@@ -369,6 +371,88 @@ Testb_MintAndSpend()
 	return false;
 }
 
+bool
+Testb_Throughput()
+{
+	// This test assumes a list of coins were generated in Testb_MintCoin()
+	if (ggCoins[0] == NULL) {
+		return false;
+	}
+
+	try {
+		const IntegerGroupParams& group = gg_Params->coinCommitmentGroup;
+		vector<CBigNum> vValues;
+		for (uint32_t i = 0; i < TESTS_COMMITMENTS_TO_BENCHMARK; i++) {
+			vValues.push_back(CBigNum::randBignum(group.groupOrder));
+		}
+
+		// Pedersen commitments, generic exponentiation vs. precomputed tables
+		timer.start();
+		for (uint32_t i = 0; i < TESTS_COMMITMENTS_TO_BENCHMARK; i++) {
+			group.g.pow_mod(vValues[i], group.modulus).mul_mod(group.h.pow_mod(vValues[i], group.modulus), group.modulus);
+		}
+		timer.stop();
+		int nGeneric = std::max(timer.duration(), 1);
+
+		timer.start();
+		for (uint32_t i = 0; i < TESTS_COMMITMENTS_TO_BENCHMARK; i++) {
+			group.powGH(vValues[i], vValues[i]);
+		}
+		timer.stop();
+		int nFixedBase = std::max(timer.duration(), 1);
+
+		cout << "\tCOMMITMENT THROUGHPUT:\n\t\tpow_mod: " << 1000.0 * TESTS_COMMITMENTS_TO_BENCHMARK / nGeneric << " /s\n\t\tFixed base: " << 1000.0 * TESTS_COMMITMENTS_TO_BENCHMARK / nFixedBase << " /s" << endl;
+
+		// Mint
+		timer.start();
+		for (uint32_t i = 0; i < TESTS_SPENDS_TO_BENCHMARK; i++) {
+			PrivateCoin coin(gg_Params, CoinDenomination::ZQ_ONE);
+		}
+		timer.stop();
+
+		cout << "\tMINT THROUGHPUT: " << 1000.0 * TESTS_SPENDS_TO_BENCHMARK / std::max(timer.duration(), 1) << " /s" << endl;
+
+		// Spend and verify coins out of a common accumulator
+		Accumulator acc(&gg_Params->accumulatorParams, CoinDenomination::ZQ_ONE);
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			acc += ggCoins[i]->getPublicCoin();
+		}
+
+		vector<CoinSpend*> vSpends;
+		int nSpendTime = 0;
+		for (uint32_t i = 0; i < TESTS_SPENDS_TO_BENCHMARK; i++) {
+			AccumulatorWitness wAcc(gg_Params, Accumulator(&gg_Params->accumulatorParams, CoinDenomination::ZQ_ONE), ggCoins[i]->getPublicCoin());
+			for (uint32_t j = 0; j < TESTS_COINS_TO_ACCUMULATE; j++) {
+				wAcc += ggCoins[j]->getPublicCoin();
+			}
+
+			timer.start();
+			vSpends.push_back(new CoinSpend(gg_Params, *(ggCoins[i]), acc, 0, wAcc, 0));
+			timer.stop();
+			nSpendTime += timer.duration();
+		}
+
+		cout << "\tSPEND THROUGHPUT: " << 1000.0 * TESTS_SPENDS_TO_BENCHMARK / std::max(nSpendTime, 1) << " /s" << endl;
+
+		bool ret = true;
+		timer.start();
+		for (uint32_t i = 0; i < TESTS_SPENDS_TO_BENCHMARK; i++) {
+			ret &= vSpends[i]->Verify(acc);
+		}
+		timer.stop();
+
+		cout << "\tSPEND VERIFY THROUGHPUT: " << 1000.0 * TESTS_SPENDS_TO_BENCHMARK / std::max(timer.duration(), 1) << " /s" << endl;
+
+		for (uint32_t i = 0; i < vSpends.size(); i++) {
+			delete vSpends[i];
+		}
+		return ret;
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+}
+
 void
 Testb_RunAllTests()
 {
@@ -388,6 +472,7 @@ Testb_RunAllTests()
 	gLogTestResult("coins can be minted", Testb_MintCoin);
 	gLogTestResult("the accumulator works", Testb_Accumulator);
 	gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+	gLogTestResult("mint, spend and verify throughput", Testb_Throughput);
 
 	// Summarize test results
 	if (ggSuccessfulTests < ggNumTests) {
@@ -0,0 +1,165 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the memoized CBlockHeader::GetHash()
+//
+
+#include "hash.h"
+#include "primitives/block.h"
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockheader_tests)
+
+static CBlockHeader MakeHeader(int32_t nVersion)
+{
+    CBlockHeader header;
+    header.nVersion = nVersion;
+    header.hashPrevBlock = uint256(1);
+    header.hashMerkleRoot = uint256(2);
+    header.nTime = 1500000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 42;
+    return header;
+}
+
+//! The hash of the header computed directly, bypassing the memo
+static uint256 FreshHash(const CBlockHeader& header)
+{
+    if (header.nVersion < 4)
+        return XEVAN(BEGIN(header.nVersion), END(header.nNonce));
+    return Hash(BEGIN(header.nVersion), END(header.nAccumulatorCheckpoint));
+}
+
+static void HashRepeatedly(const CBlockHeader* pheader, uint256* phash, bool* pfConsistent)
+{
+    for (int n = 0; n < 50; n++) {
+        uint256 hash = pheader->GetHash();
+        if (n > 0 && hash != *phash)
+            *pfConsistent = false;
+        *phash = hash;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockheader_hash_cache_invalidation)
+{
+    for (int32_t nVersion = 3; nVersion <= 4; nVersion++) {
+        CBlockHeader header = MakeHeader(nVersion);
+        uint256 hash = header.GetHash();
+        BOOST_CHECK(header.GetHash() == hash);
+
+        // Every field that is hashed must invalidate the cached value
+        header.nNonce++;
+        BOOST_CHECK(header.GetHash() != hash);
+        header.nNonce--;
+        BOOST_CHECK(header.GetHash() == hash);
+
+        header.nTime++;
+        BOOST_CHECK(header.GetHash() != hash);
+        header.nTime--;
+
+        header.hashMerkleRoot = uint256(3);
+        BOOST_CHECK(header.GetHash() != hash);
+        header.hashMerkleRoot = uint256(2);
+        BOOST_CHECK(header.GetHash() == hash);
+
+        // Copies and blocks built from the header carry the same hash
+        CBlockHeader copy = header;
+        BOOST_CHECK(copy.GetHash() == hash);
+        CBlock block(header);
+        BOOST_CHECK(block.GetHash() == hash);
+        BOOST_CHECK(block.GetBlockHeader().GetHash() == hash);
+    }
+
+    // The accumulator checkpoint is only part of the hash from version 4 on
+    CBlockHeader legacy = MakeHeader(3);
+    uint256 hashLegacy = legacy.GetHash();
+    legacy.nAccumulatorCheckpoint = uint256(7);
+    BOOST_CHECK(legacy.GetHash() == hashLegacy);
+
+    CBlockHeader current = MakeHeader(4);
+    uint256 hashCurrent = current.GetHash();
+    current.nAccumulatorCheckpoint = uint256(7);
+    BOOST_CHECK(current.GetHash() != hashCurrent);
+
+    // Switching version switches algorithm
+    current.nVersion = 3;
+    BOOST_CHECK(current.GetHash() == legacy.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(blockheader_hash_cache_benchmark)
+{
+    // Block validation asks for the hash of the same block several times
+    // (ProcessNewBlock, CheckBlock, AcceptBlock, stake kernel and logging)
+    const int nCallsPerBlock = 8;
+    const int nBlocks = 200;
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockHeader header = MakeHeader(3);
+        header.nNonce = i;
+        for (int n = 0; n < nCallsPerBlock; n++) {
+            // flip a bit between calls so every call recomputes, as before memoization
+            header.nBits ^= 1;
+            header.GetHash();
+        }
+    }
+    int64_t nUncached = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockHeader header = MakeHeader(3);
+        header.nNonce = i;
+        for (int n = 0; n < nCallsPerBlock; n++)
+            header.GetHash();
+    }
+    int64_t nCached = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE(strprintf("XEVAN header hash, %d calls per block over %d blocks: %dus recomputed, %dus memoized",
+        nCallsPerBlock, nBlocks, nUncached, nCached));
+
+    // Timings depend on the machine, correctness does not: the memo must equal a fresh computation
+    for (int32_t nVersion = 3; nVersion <= 4; nVersion++) {
+        CBlockHeader header = MakeHeader(nVersion);
+        header.GetHash();
+        BOOST_CHECK(header.GetHash() == FreshHash(header));
+        header.nNonce++;
+        BOOST_CHECK(header.GetHash() == FreshHash(header));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockheader_hash_cache_concurrent)
+{
+    // Header hashing threads and validation hash the same header through const references
+    for (int32_t nVersion = 3; nVersion <= 4; nVersion++) {
+        const CBlockHeader header = MakeHeader(nVersion);
+        const int nThreads = 4;
+        uint256 vHashes[nThreads];
+        bool vConsistent[nThreads];
+
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++) {
+            vConsistent[i] = true;
+            threads.create_thread(boost::bind(&HashRepeatedly, &header, &vHashes[i], &vConsistent[i]));
+        }
+        threads.join_all();
+
+        for (int i = 0; i < nThreads; i++) {
+            BOOST_CHECK(vConsistent[i]);
+            BOOST_CHECK(vHashes[i] == FreshHash(header));
+        }
+
+        // A copy made after the threads finished carries the memoized value
+        CBlockHeader copy = header;
+        BOOST_CHECK(copy.GetHash() == FreshHash(header));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,189 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests and benchmark for the stake kernel search
+//
+
+#include "kernel.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(stake_kernel_hash)
+{
+    uint64_t nStakeModifier = 0x0123456789abcdefULL;
+    unsigned int nTimeBlockFrom = 1510000000;
+    COutPoint prevout(uint256("0x9f4e8c3a0b1d2e3f405162738495a6b7c8d9eafb0c1d2e3f4051627384950a1b"), 3);
+    unsigned int nBits = 0x1e0fffff;
+    int64_t nValue = 1000 * COIN;
+
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout, nValue, nBits);
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier;
+    for (unsigned int nTimeTx = nTimeBlockFrom + 3600; nTimeTx < nTimeBlockFrom + 3700; nTimeTx++) {
+        uint256 hashExpected = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
+        BOOST_CHECK(kernel.GetHash(nTimeTx) == hashExpected);
+        BOOST_CHECK_EQUAL(kernel.CheckHash(hashExpected), stakeTargetHit(hashExpected, nValue, bnTargetPerCoinDay));
+    }
+
+    // Search must pick the same timestamp as sweeping the window from the top with stakeHash
+    for (unsigned int nBitsTry : {0x1d00ffffU, 0x1e00ffffU, 0x1e0fffffU}) {
+        CStakeKernel kernelTry(nStakeModifier, nTimeBlockFrom, prevout, nValue, nBitsTry);
+        bnTargetPerCoinDay.SetCompact(nBitsTry);
+        unsigned int nTimeStart = nTimeBlockFrom + 3600;
+        unsigned int nHashDrift = 200;
+
+        bool fExpected = false;
+        unsigned int nTimeExpected = 0;
+        for (unsigned int i = 0; i < nHashDrift && !fExpected; i++) {
+            nTimeExpected = nTimeStart + nHashDrift - i;
+            fExpected = stakeTargetHit(stakeHash(nTimeExpected, ss, prevout.n, prevout.hash, nTimeBlockFrom), nValue, bnTargetPerCoinDay);
+        }
+
+        unsigned int nTimeTx = nTimeStart;
+        uint256 hashProofOfStake;
+        BOOST_CHECK_EQUAL(kernelTry.Search(nTimeTx, nHashDrift, hashProofOfStake), fExpected);
+        if (fExpected) {
+            BOOST_CHECK_EQUAL(nTimeTx, nTimeExpected);
+            BOOST_CHECK(hashProofOfStake == kernelTry.GetHash(nTimeTx));
+        }
+    }
+}
+
+// The kernel stake modifier as GetKernelStakeModifier finds it by walking forward from pindexFrom to pindexTip
+static bool WalkKernelStakeModifier(const CBlockIndex* pindexTip, const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight)
+{
+    int64_t nTimeTarget = pindexFrom->GetBlockTime() + GetStakeModifierSelectionInterval();
+    for (int nHeight = pindexFrom->nHeight + 1; nHeight <= pindexTip->nHeight; nHeight++) {
+        const CBlockIndex* pindex = pindexTip->GetAncestor(nHeight);
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() >= nTimeTarget) {
+            nStakeModifier = pindex->nStakeModifier;
+            nStakeModifierHeight = nHeight;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void CheckStakeModifierIndex(const CStakeModifierIndex& index, const CBlockIndex* pindexTip)
+{
+    for (int nHeight = 0; nHeight <= pindexTip->nHeight; nHeight++) {
+        const CBlockIndex* pindexFrom = pindexTip->GetAncestor(nHeight);
+        uint64_t nModifierExpected = 0, nModifier = 0;
+        int nHeightExpected = 0, nHeightModifier = 0;
+        int64_t nTimeModifier = 0;
+        bool fExpected = WalkKernelStakeModifier(pindexTip, pindexFrom, nModifierExpected, nHeightExpected);
+        BOOST_CHECK_EQUAL(index.GetKernelStakeModifier(pindexFrom, nModifier, nHeightModifier, nTimeModifier), fExpected);
+        if (fExpected) {
+            BOOST_CHECK_EQUAL(nModifier, nModifierExpected);
+            BOOST_CHECK_EQUAL(nHeightModifier, nHeightExpected);
+            BOOST_CHECK_EQUAL(nTimeModifier, pindexTip->GetAncestor(nHeightExpected)->GetBlockTime());
+        }
+    }
+}
+
+// Blocks roughly a minute apart with jittered, not always increasing, timestamps
+static void BuildBranch(std::vector<CBlockIndex>& vBranch, CBlockIndex* pindexFork, int nStartHeight, int64_t nStartTime)
+{
+    for (unsigned int i = 0; i < vBranch.size(); i++) {
+        CBlockIndex& block = vBranch[i];
+        block.nHeight = nStartHeight + i;
+        block.pprev = i ? &vBranch[i - 1] : pindexFork;
+        block.nTime = nStartTime + 60 * i + (insecure_rand() % 240) - 120;
+        bool fGenerated = insecure_rand() % 5 != 0;
+        block.SetStakeModifier(fGenerated ? ((uint64_t)insecure_rand() << 32 | insecure_rand()) : (block.pprev ? block.pprev->nStakeModifier : 0), fGenerated || !block.pprev);
+        block.BuildSkip();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index)
+{
+    std::vector<CBlockIndex> vMain(400);
+    BuildBranch(vMain, NULL, 0, 1510000000);
+    std::vector<CBlockIndex> vFork(150);
+    BuildBranch(vFork, &vMain[299], 300, vMain[299].nTime + 90);
+
+    CStakeModifierIndex index;
+
+    // connect the main chain a block at a time
+    for (unsigned int i = 0; i < vMain.size(); i++) {
+        index.SetTip(&vMain[i]);
+        chainActive.SetTip(&vMain[i]);
+        if (i % 20 == 0 || i + 1 == vMain.size())
+            CheckStakeModifierIndex(index, &vMain[i]);
+    }
+
+    // the index only answers for the active chain
+    chainActive.SetTip(&vMain[350]);
+    uint64_t nModifier;
+    int nHeightModifier;
+    int64_t nTimeModifier;
+    BOOST_CHECK(!index.GetKernelStakeModifier(&vMain[10], nModifier, nHeightModifier, nTimeModifier));
+
+    // reorg to the longer fork and back, and disconnect blocks one at a time
+    index.SetTip(&vFork.back());
+    chainActive.SetTip(&vFork.back());
+    CheckStakeModifierIndex(index, &vFork.back());
+    BOOST_CHECK(!index.GetKernelStakeModifier(&vMain[350], nModifier, nHeightModifier, nTimeModifier));
+
+    index.SetTip(&vMain.back());
+    chainActive.SetTip(&vMain.back());
+    CheckStakeModifierIndex(index, &vMain.back());
+
+    for (int nHeight = vMain.size() - 2; nHeight >= 250; nHeight -= 7) {
+        index.SetTip(&vMain[nHeight]);
+        chainActive.SetTip(&vMain[nHeight]);
+        CheckStakeModifierIndex(index, &vMain[nHeight]);
+    }
+
+    index.SetTip(NULL);
+    chainActive.SetTip(NULL);
+    BOOST_CHECK(!index.GetKernelStakeModifier(&vMain[10], nModifier, nHeightModifier, nTimeModifier));
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_benchmark)
+{
+    const int nCoins = 2000;
+    const unsigned int nHashDrift = 45;
+    unsigned int nTimeBlockFrom = 1510000000;
+    unsigned int nTimeTx = nTimeBlockFrom + 7200;
+    // unreachable target so that every timestamp of every coin is tried
+    unsigned int nBits = 0x03000001;
+
+    CDataStream ss(SER_GETHASH, 0);
+    ss << (uint64_t)42;
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    int64_t nStart = GetTimeMicros();
+    for (int n = 0; n < nCoins; n++) {
+        for (unsigned int i = 0; i < nHashDrift; i++) {
+            uint256 hash = stakeHash(nTimeTx + nHashDrift - i, ss, n, uint256(n), nTimeBlockFrom);
+            BOOST_CHECK(!stakeTargetHit(hash, COIN, bnTargetPerCoinDay));
+        }
+    }
+    int64_t nLegacy = std::max(GetTimeMicros() - nStart, (int64_t)1);
+
+    nStart = GetTimeMicros();
+    for (int n = 0; n < nCoins; n++) {
+        CStakeKernel kernel(42, nTimeBlockFrom, COutPoint(uint256(n), n), COIN, nBits);
+        unsigned int nTimeFound = nTimeTx;
+        uint256 hashProofOfStake;
+        BOOST_CHECK(!kernel.Search(nTimeFound, nHashDrift, hashProofOfStake));
+    }
+    int64_t nKernel = std::max(GetTimeMicros() - nStart, (int64_t)1);
+
+    double nKernels = (double)nCoins * nHashDrift;
+    BOOST_TEST_MESSAGE(strprintf("stake kernels tested per second: stakeHash %.0f, CStakeKernel %.0f (single thread)",
+        nKernels * 1000000 / nLegacy, nKernels * 1000000 / nKernel));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
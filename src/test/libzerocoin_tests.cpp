@@ -315,6 +315,62 @@ Test_EqualityPoK()
 	return true;
 }
 
+bool
+Test_FixedBaseExp()
+{
+	try {
+		const IntegerGroupParams* groups[] = {&g_Params->coinCommitmentGroup,
+		                                      &g_Params->serialNumberSoKCommitmentGroup,
+		                                      &g_Params->accumulatorParams.accumulatorPoKCommitmentGroup};
+		const AccumulatorAndProofParams& acc = g_Params->accumulatorParams;
+
+		// Deserialized parameters carry no tables and must give the same results without them
+		CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+		ss << acc;
+		AccumulatorAndProofParams accPlain;
+		ss >> accPlain;
+
+		for (uint32_t i = 0; i < 20; i++) {
+			// Cover small, table-sized and wider-than-table exponents of both signs
+			CBigNum range = CBigNum(2).pow((i % 4) * 1024 + 64);
+			CBigNum e = CBigNum::randBignum(range);
+			CBigNum f = CBigNum::randBignum(range);
+			if (i % 3 == 0) {
+				e = 0 - e;
+			}
+			if (i == 0) {
+				f = 0;
+			}
+
+			for (uint32_t j = 0; j < 3; j++) {
+				const IntegerGroupParams* group = groups[j];
+				CBigNum gPow = group->g.pow_mod(e, group->modulus);
+				CBigNum hPow = group->h.pow_mod(f, group->modulus);
+				if (group->powG(e) != gPow || group->powH(f) != hPow ||
+				        group->powGH(e, f) != gPow.mul_mod(hPow, group->modulus) ||
+				        group->powMod(group->h, e) != group->h.pow_mod(e, group->modulus)) {
+					return false;
+				}
+			}
+
+			if (acc.qrnPowG(e) != acc.accumulatorQRNCommitmentGroup.g.pow_mod(e, acc.accumulatorModulus) ||
+			        acc.qrnPowH(f) != acc.accumulatorQRNCommitmentGroup.h.pow_mod(f, acc.accumulatorModulus) ||
+			        acc.accumulatorPowMod(acc.accumulatorBase, f) != acc.accumulatorBase.pow_mod(f, acc.accumulatorModulus)) {
+				return false;
+			}
+
+			if (accPlain.qrnPowG(e) != acc.qrnPowG(e) ||
+			        accPlain.accumulatorPoKCommitmentGroup.powG(e) != acc.accumulatorPoKCommitmentGroup.powG(e)) {
+				return false;
+			}
+		}
+	} catch (runtime_error &e) {
+		return false;
+	}
+
+	return true;
+}
+
 bool
 Test_MintCoin()
 {
@@ -458,6 +514,7 @@ Test_RunAllTests()
 	LogTestResult("parameter sizes are correct", Test_CalcParamSizes);
 	LogTestResult("group/field parameters can be generated", Test_GenerateGroupParams);
 	LogTestResult("parameter generation is correct", Test_ParamGen);
+	LogTestResult("fixed-base exponentiation matches pow_mod", Test_FixedBaseExp);
 	LogTestResult("coins can be minted", Test_MintCoin);
 	LogTestResult("invalid coins will be rejected", Test_InvalidCoin);
 	LogTestResult("the accumulator works", Test_Accumulator);
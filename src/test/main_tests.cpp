@@ -5,7 +5,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "clientversion.h"
 #include "main.h"
+#include "random.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -48,4 +50,200 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(hash_block_headers_test)
+{
+    // Mix legacy XEVAN headers with version 4 double-SHA256 ones
+    std::vector<CBlockHeader> vHeaders(64);
+    for (unsigned int i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].nVersion = (i % 3 == 0) ? 4 : 1;
+        vHeaders[i].nTime = 1500000000 + i;
+        vHeaders[i].nBits = 0x1e0ffff0;
+        vHeaders[i].nNonce = i * 7919;
+    }
+
+    std::vector<const CBlockHeader*> vpHeaders;
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        vpHeaders.push_back(&vHeaders[i]);
+
+    std::vector<uint256> vHashes;
+    HashBlockHeaders(vpHeaders, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), vHeaders.size());
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        BOOST_CHECK(vHashes[i] == vHeaders[i].GetHash());
+
+    // Empty and single element batches bypass the queue
+    vpHeaders.resize(1);
+    HashBlockHeaders(vpHeaders, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), 1U);
+    BOOST_CHECK(vHashes[0] == vHeaders[0].GetHash());
+    vpHeaders.clear();
+    HashBlockHeaders(vpHeaders, vHashes);
+    BOOST_CHECK(vHashes.empty());
+}
+
+BOOST_AUTO_TEST_CASE(supply_read_checks_test)
+{
+    // blocks moving some value around, stored in a block file of their own
+    std::vector<CBlock> vBlocks(20);
+    std::vector<CDiskBlockPos> vPos;
+    CDiskBlockPos posWrite(9999, 0);
+    CAmount nValueOutTotal = 0;
+    unsigned int nInputsTotal = 0;
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        CBlock& block = vBlocks[i];
+        block.nBits = Params().ProofOfWorkLimit().GetCompact();
+        block.nTime = i;
+
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << (int64_t)i << OP_0;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nValue = 250 * COIN;
+        block.vtx.push_back(txCoinbase);
+        nValueOutTotal += txCoinbase.vout[0].nValue;
+
+        for (unsigned int n = 0; n < i % 4; n++) {
+            CMutableTransaction tx;
+            tx.vin.resize(n + 1);
+            for (unsigned int j = 0; j < tx.vin.size(); j++)
+                tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            tx.vout.resize(2);
+            tx.vout[0].nValue = (i + 1) * COIN;
+            tx.vout[1].nValue = n * CENT;
+            block.vtx.push_back(tx);
+            nValueOutTotal += tx.vout[0].nValue + tx.vout[1].nValue;
+            nInputsTotal += tx.vin.size();
+        }
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        CDiskBlockPos pos = posWrite;
+        BOOST_CHECK(WriteBlockToDisk(block, pos));
+        vPos.push_back(pos);
+        posWrite.nPos = pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    }
+
+    // read them once on this thread and once on the supply reading threads
+    const int nFlags = RECALC_ZUMB_MINTED | RECALC_ZUMB_SPENT | RECALC_UMB_SUPPLY;
+    std::vector<CSupplyBlockData> vSerial(vBlocks.size()), vParallel(vBlocks.size());
+    std::vector<CSupplyReadCheck> vChecks;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        vChecks.push_back(CSupplyReadCheck(vPos[i], CDiskBlockPos(), vBlocks[i].GetHash(), uint256(), i + 1, nFlags, true, &vSerial[i]));
+    BOOST_FOREACH (CSupplyReadCheck& check, vChecks)
+        BOOST_CHECK(check());
+
+    vChecks.clear();
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        vChecks.push_back(CSupplyReadCheck(vPos[i], CDiskBlockPos(), vBlocks[i].GetHash(), uint256(), i + 1, nFlags, true, &vParallel[i]));
+    BOOST_CHECK(nScriptCheckThreads > 0);
+    BOOST_CHECK(RunSupplyReadChecks(vChecks));
+
+    CAmount nValueOutSerial = 0;
+    unsigned int nInputsSerial = 0;
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        BOOST_CHECK_EQUAL(vParallel[i].nValueIn, vSerial[i].nValueIn);
+        BOOST_CHECK_EQUAL(vParallel[i].nValueOut, vSerial[i].nValueOut);
+        BOOST_CHECK(vParallel[i].vPrevoutsMissing == vSerial[i].vPrevoutsMissing);
+        BOOST_CHECK(vParallel[i].listSpends == vSerial[i].listSpends);
+        BOOST_CHECK_EQUAL(vParallel[i].listPubcoins.size(), vSerial[i].listPubcoins.size());
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            BOOST_CHECK_EQUAL(vParallel[i].mints.Count(denom), vSerial[i].mints.Count(denom));
+        nValueOutSerial += vSerial[i].nValueOut;
+        nInputsSerial += vSerial[i].vPrevoutsMissing.size();
+    }
+    BOOST_CHECK_EQUAL(nValueOutSerial, nValueOutTotal);
+    BOOST_CHECK_EQUAL(nInputsSerial, nInputsTotal);
+
+    // a block that does not match the hash taken from its index fails the batch
+    std::vector<CSupplyBlockData> vBad(2);
+    vChecks.clear();
+    vChecks.push_back(CSupplyReadCheck(vPos[0], CDiskBlockPos(), vBlocks[0].GetHash(), uint256(), 1, nFlags, false, &vBad[0]));
+    vChecks.push_back(CSupplyReadCheck(vPos[1], CDiskBlockPos(), vBlocks[0].GetHash(), uint256(), 2, nFlags, false, &vBad[1]));
+    BOOST_CHECK(!RunSupplyReadChecks(vChecks));
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_read_test)
+{
+    CBlock block;
+    block.nBits = Params().ProofOfWorkLimit().GetCompact();
+    block.nTime = 1234;
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << OP_1 << OP_0;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = 250 * COIN;
+    block.vtx.push_back(txCoinbase);
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    // stored behind a block already in the file, the way AcceptBlock appends them
+    CDiskBlockPos pos(9997, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    pos.nPos += ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hashBlock;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus |= BLOCK_HAVE_DATA;
+
+    // the raw bytes are exactly the serialization of the block ReadBlockFromDisk returns
+    CBlock blockRead;
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, &index));
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << blockRead;
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssRaw, &index));
+    BOOST_CHECK(ssRaw.str() == ssExpected.str());
+
+    // served from the cache the second time
+    std::shared_ptr<const CDataStream> pssFirst, pssSecond;
+    BOOST_CHECK(GetRawBlock(&index, pssFirst));
+    BOOST_CHECK(GetRawBlock(&index, pssSecond));
+    BOOST_CHECK(pssFirst == pssSecond);
+    BOOST_CHECK(pssFirst->str() == ssExpected.str());
+
+    // an index pointing at another block is refused
+    uint256 hashOther = GetRandHash();
+    index.phashBlock = &hashOther;
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssRaw, &index));
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_cache_test)
+{
+    CRawBlockCache cache(MAX_RAW_BLOCK_CACHE_SIZE);
+    const size_t nBlockSize = 1000 * 1000;
+    std::vector<uint256> vHashes;
+    std::shared_ptr<const CDataStream> pssBlock;
+    for (int i = 0; i < 40; i++) {
+        std::shared_ptr<CDataStream> pssInsert(new CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+        pssInsert->resize(nBlockSize);
+        vHashes.push_back(GetRandHash());
+        cache.Insert(vHashes.back(), pssInsert);
+        BOOST_CHECK(cache.GetSize() <= MAX_RAW_BLOCK_CACHE_SIZE);
+
+        // the first block keeps being served, so it is never the least recently used
+        BOOST_CHECK(cache.Get(vHashes[0], pssBlock));
+    }
+    BOOST_CHECK_EQUAL(cache.GetSize(), MAX_RAW_BLOCK_CACHE_SIZE / nBlockSize * nBlockSize);
+
+    // the oldest of the others were dropped, the newest are kept
+    BOOST_CHECK(cache.Get(vHashes[0], pssBlock));
+    BOOST_CHECK(!cache.Get(vHashes[1], pssBlock));
+    BOOST_CHECK(cache.Get(vHashes.back(), pssBlock));
+    BOOST_CHECK_EQUAL(pssBlock->size(), nBlockSize);
+
+    // inserting a block twice does not count it twice
+    size_t nSize = cache.GetSize();
+    cache.Insert(vHashes.back(), pssBlock);
+    BOOST_CHECK_EQUAL(cache.GetSize(), nSize);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "miner.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -99,4 +100,351 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorDescendantTest)
+{
+    // parent -> child -> grandchild, each paying a different fee
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0) {
+            tx[i].vin[0].prevout.hash = tx[i - 1].GetHash();
+            tx[i].vin[0].prevout.n = 0;
+        }
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL - i * 1000LL;
+    }
+    const CAmount nFee[3] = {1000, 2000, 4000};
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::list<CTransaction> removed;
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFee[i], 0, 0.0, 1));
+
+    uint64_t nSize = testPool.mapTx[tx[0].GetHash()].GetTxSize();
+    const CTxMemPoolEntry& parent = testPool.mapTx[tx[0].GetHash()];
+    const CTxMemPoolEntry& grandchild = testPool.mapTx[tx[2].GetHash()];
+    BOOST_CHECK_EQUAL(parent.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parent.GetFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), 3 * nSize);
+    BOOST_CHECK_EQUAL(grandchild.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandchild.GetFeesWithAncestors(), 7000);
+    BOOST_CHECK_EQUAL(grandchild.GetCountWithDescendants(), 1);
+
+    // The parent is mined: the rest stays with its ancestor state reduced
+    testPool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    removed.clear();
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[2].GetHash()].GetFeesWithAncestors(), 6000);
+
+    // ... and comes back after a reorg, underneath its descendants
+    testPool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], nFee[0], 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[0].GetHash()].GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[2].GetHash()].GetFeesWithAncestors(), 7000);
+
+    // Dropping the leaf only touches its ancestors' descendant state
+    testPool.remove(tx[2], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    removed.clear();
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[0].GetHash()].GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[0].GetHash()].GetFeesWithDescendants(), 3000);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetFeesWithAncestors(), 3000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+
+    // A flood of low fee transactions, with a few well paying ones in between
+    std::vector<uint256> vHighFee;
+    for (int i = 0; i < 2000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].prevout.n = 0;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10000LL;
+        bool fHighFee = (i % 100 == 0);
+        if (fHighFee)
+            vHighFee.push_back(tx.GetHash());
+        testPool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, fHighFee ? 100000 : 10 + i % 7, i, 0.0, 1));
+    }
+    BOOST_CHECK_EQUAL(testPool.size(), 2000);
+
+    // Trimming keeps the usage under the limit and drops the cheapest first
+    uint64_t nLimit = testPool.DynamicMemoryUsage() / 4;
+    std::list<CTransaction> removed;
+    testPool.TrimToSize(nLimit, &removed);
+    BOOST_CHECK(testPool.DynamicMemoryUsage() <= nLimit);
+    BOOST_CHECK_EQUAL(testPool.size() + removed.size(), 2000);
+    BOOST_FOREACH (const uint256& hash, vHighFee)
+        BOOST_CHECK(testPool.exists(hash));
+
+    // Usage stays bounded as the flood goes on
+    for (int i = 0; i < 2000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10000LL;
+        testPool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 10, 2000 + i, 0.0, 1));
+        testPool.TrimToSize(nLimit);
+        BOOST_CHECK(testPool.DynamicMemoryUsage() <= nLimit);
+    }
+    BOOST_FOREACH (const uint256& hash, vHighFee)
+        BOOST_CHECK(testPool.exists(hash));
+
+    // Expiry drops everything that entered before the given time
+    testPool.Expire(4000);
+    BOOST_CHECK_EQUAL(testPool.size(), 0);
+    BOOST_CHECK_EQUAL(testPool.DynamicMemoryUsage(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageLimitsTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+
+    // A chain of ten transactions, each spending the one before
+    uint256 hashPrev = GetRandHash();
+    uint64_t nChainSize = 0;
+    for (int i = 0; i < 10; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vin[0].prevout = COutPoint(hashPrev, 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10000LL;
+        CTxMemPoolEntry entry(tx, 1000, i, 0.0, 1);
+        testPool.addUnchecked(tx.GetHash(), entry);
+        nChainSize += entry.GetTxSize();
+        hashPrev = tx.GetHash();
+    }
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(hashPrev, 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 10000LL;
+    CTxMemPoolEntry entryChild(txChild, 1000, 10, 0.0, 1);
+    uint64_t nPackageSize = nChainSize + entryChild.GetTxSize();
+
+    LOCK(testPool.cs);
+    std::set<uint256> setAncestors;
+    std::string errString;
+    BOOST_CHECK(testPool.CalculateMemPoolAncestors(entryChild, setAncestors, 11, nPackageSize, 11, nPackageSize, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 10);
+
+    // One more than the limits allow, counted from either end of the chain
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entryChild, setAncestors, 10, nPackageSize, 11, nPackageSize, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entryChild, setAncestors, 11, nPackageSize - 1, 11, nPackageSize, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entryChild, setAncestors, 11, nPackageSize, 10, nPackageSize, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entryChild, setAncestors, 11, nPackageSize, 11, nPackageSize - 1, errString));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRollingMinFeeTest)
+{
+    CTxMemPool testPool(CFeeRate(1000));
+    BOOST_CHECK(testPool.GetMinFee(1) == CFeeRate(0));
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10000LL;
+    CTxMemPoolEntry entry(tx, 10000, 0, 0.0, 1);
+    testPool.addUnchecked(tx.GetHash(), entry);
+
+    // Evicting a package raises the minimum above its fee rate, where it stays until a block comes in
+    int64_t nNow = GetTime();
+    SetMockTime(nNow);
+    testPool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(testPool.size(), 0);
+    CAmount nMinFeePerK = CFeeRate(10000, entry.GetTxSize()).GetFeePerK() + 1000;
+    BOOST_CHECK(testPool.GetMinFee(1) == CFeeRate(nMinFeePerK));
+    SetMockTime(nNow + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(testPool.GetMinFee(1) == CFeeRate(nMinFeePerK));
+
+    // ... then halves every ROLLING_FEE_HALFLIFE, and drops back to nothing near the relay fee
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    testPool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(nNow + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(testPool.GetMinFee(1) == CFeeRate(nMinFeePerK / 2));
+    SetMockTime(nNow + 20 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(testPool.GetMinFee(1) == CFeeRate(0));
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorScoreTest)
+{
+    // A cheap parent with a well paying child, and an unrelated transaction in between
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+    tx[1].vin[0].prevout.hash = tx[0].GetHash();
+    const CAmount nFee[3] = {100, 10000, 3000};
+
+    CTxMemPool testPool(CFeeRate(0));
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFee[i], 0, 0.0, 1));
+
+    // The child pays for its parent and goes first, the parent on its own goes last
+    BOOST_CHECK(testPool.setByAncestorScore.rbegin()->second == tx[1].GetHash());
+    BOOST_CHECK(testPool.setByAncestorScore.begin()->second == tx[0].GetHash());
+
+    // Fee deltas count towards the scores of the transaction and everything linked to it
+    testPool.PrioritiseTransaction(tx[2].GetHash(), tx[2].GetHash().ToString(), 0.0, 20000);
+    BOOST_CHECK(testPool.setByAncestorScore.rbegin()->second == tx[2].GetHash());
+    testPool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0.0, 1000);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[0].GetHash()].GetFeesWithDescendants(), 11100);
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetFeesWithAncestors(), 11100);
+
+    // ... including those given before the transaction arrives
+    std::list<CTransaction> removed;
+    testPool.remove(tx[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    for (int i = 0; i < 2; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFee[i], 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.mapTx[tx[1].GetHash()].GetFeesWithAncestors(), 11100);
+    BOOST_CHECK_EQUAL(testPool.setByAncestorScore.size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolZerocoinSpendsTest)
+{
+    // Two plain transactions and a zerocoin spend
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+    tx[2].vin[0].prevout.SetNull();
+    tx[2].vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND;
+    BOOST_CHECK(CTransaction(tx[2]).IsZerocoinSpend());
+
+    // Only the spend is kept apart for the block assembler, whatever it pays
+    CTxMemPool testPool(CFeeRate(0));
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.setZerocoinSpends.size(), 1);
+    BOOST_CHECK(testPool.setZerocoinSpends.count(tx[2].GetHash()));
+
+    std::list<CTransaction> removed;
+    testPool.remove(tx[0], removed);
+    BOOST_CHECK_EQUAL(testPool.setZerocoinSpends.size(), 1);
+    testPool.remove(tx[2], removed);
+    BOOST_CHECK(testPool.setZerocoinSpends.empty());
+
+    testPool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.setZerocoinSpends.size(), 1);
+    testPool.clear();
+    BOOST_CHECK(testPool.setZerocoinSpends.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorScoreBenchmark)
+{
+    // A synthetic pool of 50k transactions, half of them spending another pool transaction
+    // and the rest spending coins the view below the block knows about
+    CTxMemPool testPool(CFeeRate(0));
+    CCoinsView coinsDummy;
+    CCoinsViewCache view(&coinsDummy);
+    view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+    std::vector<uint256> vHashes;
+    std::vector<CAmount> vValues;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < 50000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        CAmount nValueIn = 10000000LL;
+        if (i % 2) {
+            // each pool transaction is spent at most once
+            tx.vin[0].prevout = COutPoint(vHashes[i / 2], 0);
+            nValueIn = vValues[i / 2];
+        } else {
+            tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            CCoinsModifier coins = view.ModifyCoins(tx.vin[0].prevout.hash);
+            coins->nVersion = 1;
+            coins->nHeight = 1;
+            coins->vout.resize(1);
+            coins->vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            coins->vout[0].nValue = nValueIn;
+        }
+        CAmount nFee = 100 + GetRand(100000);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = nValueIn - nFee;
+        testPool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, i, 0.0, 1));
+        vHashes.push_back(tx.GetHash());
+        vValues.push_back(tx.vout[0].nValue);
+    }
+    BOOST_TEST_MESSAGE("filled a pool of " << testPool.size() << " transactions in " << (GetTimeMicros() - nStart) / 1000 << "ms");
+
+    // Fill a block the way CreateNewBlock does
+    LOCK2(cs_main, testPool.cs);
+    const unsigned int nBlockMaxSize = 250000;
+    CBlockTemplate blocktemplate;
+    blocktemplate.block.vtx.resize(1);
+    CBlockAssembler assembler(&blocktemplate, testPool, view, chainActive.Height() + 1, false);
+    nStart = GetTimeMicros();
+    assembler.AddPackagesByScore(nBlockMaxSize, 0);
+    int64_t nAssembleTime = GetTimeMicros() - nStart;
+
+    // ... against the full pass over the pool it replaces
+    nStart = GetTimeMicros();
+    std::vector<std::pair<double, uint256> > vecByFee;
+    vecByFee.reserve(testPool.mapTx.size());
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator mi = testPool.mapTx.begin(); mi != testPool.mapTx.end(); ++mi)
+        vecByFee.push_back(std::make_pair((double)mi->second.GetFee() / mi->second.GetTxSize(), mi->first));
+    std::make_heap(vecByFee.begin(), vecByFee.end());
+    int64_t nFullPassTime = GetTimeMicros() - nStart;
+    BOOST_TEST_MESSAGE("assembled " << assembler.nBlockTx << " transactions in " << nAssembleTime << "us, a full pass takes " << nFullPassTime << "us");
+
+    // The block is full, every transaction follows whatever it spends from the pool, and the first
+    // package picked is the one the index scores best
+    BOOST_CHECK(assembler.nBlockSize + 1000 >= nBlockMaxSize);
+    BOOST_CHECK(assembler.nBlockSize < nBlockMaxSize);
+    BOOST_CHECK_EQUAL(blocktemplate.block.vtx.size(), assembler.nBlockTx + 1);
+    std::set<uint256> setInBlock;
+    CAmount nFees = 0;
+    for (unsigned int i = 1; i < blocktemplate.block.vtx.size(); i++) {
+        const CTransaction& tx = blocktemplate.block.vtx[i];
+        std::map<uint256, CTxMemPoolEntry>::const_iterator mi = testPool.mapTx.find(tx.vin[0].prevout.hash);
+        BOOST_CHECK(mi == testPool.mapTx.end() || setInBlock.count(mi->first));
+        setInBlock.insert(tx.GetHash());
+        nFees += blocktemplate.vTxFees[i];
+    }
+    BOOST_CHECK_EQUAL(nFees, assembler.nFees);
+    BOOST_CHECK(assembler.IsInBlock(testPool.setByAncestorScore.rbegin()->second));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,62 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+#ifdef USE_EPOLL
+BOOST_AUTO_TEST_CASE(node_readiness_tests)
+{
+    // Only the pointers are tracked, the nodes are never dereferenced
+    char nodes[3];
+    CNode* pnodeA = (CNode*)&nodes[0];
+    CNode* pnodeB = (CNode*)&nodes[1];
+    CNode* pnodeC = (CNode*)&nodes[2];
+
+    CNodeReadiness ready;
+    BOOST_CHECK(ready.IsIdle());
+
+    // Hangups and errors are picked up by the read that reports them
+    ready.MarkReady(pnodeA, EPOLLIN);
+    ready.MarkReady(pnodeB, EPOLLOUT);
+    ready.MarkReady(pnodeC, EPOLLRDHUP | EPOLLOUT);
+    BOOST_CHECK(!ready.IsIdle());
+    BOOST_CHECK(ready.setReadable.count(pnodeA) && !ready.setWritable.count(pnodeA));
+    BOOST_CHECK(!ready.setReadable.count(pnodeB) && ready.setWritable.count(pnodeB));
+    BOOST_CHECK(ready.setReadable.count(pnodeC) && ready.setWritable.count(pnodeC));
+    ready.MarkReady(pnodeB, EPOLLERR);
+    ready.MarkReady(pnodeB, EPOLLHUP);
+    BOOST_CHECK(ready.setReadable.count(pnodeB));
+
+    // An edge reported again for a pending node does not duplicate it
+    ready.MarkReady(pnodeA, EPOLLIN | EPOLLOUT);
+    ready.MarkReady(pnodeA, EPOLLIN);
+    BOOST_CHECK_EQUAL(ready.setReadable.size(), 3U);
+    BOOST_CHECK_EQUAL(ready.setWritable.size(), 3U);
+
+    // A deleted node is gone from both sets, forgetting it twice is harmless
+    ready.Forget(pnodeC);
+    ready.Forget(pnodeC);
+    BOOST_CHECK(!ready.setReadable.count(pnodeC) && !ready.setWritable.count(pnodeC));
+    BOOST_CHECK_EQUAL(ready.setReadable.size(), 2U);
+    BOOST_CHECK_EQUAL(ready.setWritable.size(), 2U);
+
+    // Serviced nodes leave their set, the handler idles once both are empty
+    ready.setWritable.erase(pnodeA);
+    ready.setWritable.erase(pnodeB);
+    BOOST_CHECK(!ready.IsIdle());
+    ready.setReadable.erase(pnodeA);
+    ready.setReadable.erase(pnodeB);
+    BOOST_CHECK(ready.IsIdle());
+
+    ready.MarkReady(pnodeA, EPOLLIN | EPOLLOUT);
+    ready.Clear();
+    BOOST_CHECK(ready.IsIdle());
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
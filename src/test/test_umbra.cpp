@@ -52,8 +52,15 @@ struct TestingSetup {
         RegisterValidationInterface(pwalletMain);
 #endif
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadHeaderHash);
+            threadGroup.create_thread(&ThreadZerocoinSpendCheck);
+            threadGroup.create_thread(&ThreadSupplyRead);
+#ifdef ENABLE_WALLET
+            threadGroup.create_thread(&ThreadWalletScan);
+#endif
+        }
         RegisterNodeSignals(GetNodeSignals());
     }
     ~TestingSetup()
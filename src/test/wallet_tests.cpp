@@ -2,6 +2,10 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
 #include "wallet.h"
 
 #include <set>
@@ -21,6 +25,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -305,4 +311,226 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+static uint256 add_wallet_tx(const CMutableTransaction& tx, bool fConfirmed)
+{
+    CWalletTx wtx(pwalletMain, tx);
+    if (fConfirmed) {
+        // claim the genesis block, the merkle branch is not checked again once verified
+        wtx.hashBlock = chainActive.Genesis()->GetBlockHash();
+        wtx.nIndex = 0;
+        wtx.fMerkleVerified = true;
+    }
+    BOOST_CHECK(pwalletMain->AddToWallet(wtx));
+    return wtx.GetHash();
+}
+
+static bool is_stakeable(const COutPoint& outpoint)
+{
+    vector<COutput> vStakeCoins;
+    pwalletMain->AvailableStakeCoins(vStakeCoins);
+    BOOST_FOREACH(const COutput& out, vStakeCoins) {
+        if (COutPoint(out.tx->GetHash(), out.i) == outpoint)
+            return true;
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(stakeable_coins_tests)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+
+    // add: a confirmed transaction paying us twice
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.resize(2);
+    txFund.vout[0].nValue = 10 * COIN;
+    txFund.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    txFund.vout[1].nValue = 20 * COIN;
+    txFund.vout[1].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    uint256 hashFund = add_wallet_tx(txFund, true);
+    COutPoint outA(hashFund, 0), outB(hashFund, 1);
+    BOOST_CHECK(is_stakeable(outA));
+    BOOST_CHECK(is_stakeable(outB));
+
+    // spend: an unconfirmed transaction spending both
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(2);
+    txSpend.vin[0].prevout = outA;
+    txSpend.vin[1].prevout = outB;
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 29 * COIN;
+    txSpend.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    add_wallet_tx(txSpend, false);
+    mempool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 0, 0.0, 1));
+    BOOST_CHECK(!is_stakeable(outA));
+    BOOST_CHECK(!is_stakeable(outB));
+
+    // conflict: a confirmed transaction spending only the first output evicts the spend,
+    // which is never updated in the wallet, so the second output has to come back on its own
+    CMutableTransaction txConflict;
+    txConflict.vin.resize(1);
+    txConflict.vin[0].prevout = outA;
+    txConflict.vout.resize(1);
+    txConflict.vout[0].nValue = 9 * COIN;
+    txConflict.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    uint256 hashConflict = add_wallet_tx(txConflict, true);
+    std::list<CTransaction> removed;
+    mempool.removeConflicts(txConflict, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(!is_stakeable(outA));
+    BOOST_CHECK(is_stakeable(outB));
+
+    // restore: once the conflicting spend is gone the first output is ours to stake again
+    pwalletMain->EraseFromWallet(hashConflict);
+    BOOST_CHECK(is_stakeable(outA));
+    BOOST_CHECK(is_stakeable(outB));
+
+    pwalletMain->EraseFromWallet(txSpend.GetHash());
+    pwalletMain->EraseFromWallet(hashFund);
+    BOOST_CHECK(!is_stakeable(outA));
+    BOOST_CHECK(!is_stakeable(outB));
+}
+
+static CBlockIndex* add_scan_block(CBlock& block, CBlockIndex* pindexPrev, CDiskBlockPos& posWrite)
+{
+    block.nBits = Params().ProofOfWorkLimit().GetCompact();
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDiskBlockPos pos = posWrite;
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    posWrite.nPos = pos.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+
+    CBlockIndex* pindex = new CBlockIndex(block);
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(block.GetHash(), pindex)).first;
+    pindex->phashBlock = &mi->first;
+    pindex->pprev = pindexPrev;
+    pindex->nHeight = pindexPrev->nHeight + 1;
+    pindex->nFile = pos.nFile;
+    pindex->nDataPos = pos.nPos;
+    pindex->nStatus |= BLOCK_HAVE_DATA;
+    pindex->nChainTx = pindexPrev->nChainTx + block.vtx.size();
+    pindex->BuildSkip();
+    return pindex;
+}
+
+static set<uint256> scan_wallet(const CKey& key, CBlockIndex* pindexStart, int nThreads)
+{
+    CWallet walletScan(strprintf("wallet_scan_%d.dat", nThreads));
+    BOOST_CHECK(walletScan.AddKeyPubKey(key, key.GetPubKey()));
+    walletScan.nTimeFirstKey = 1;
+
+    int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    int nFound = walletScan.ScanForWalletTransactions(pindexStart);
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+
+    set<uint256> setFound;
+    LOCK(walletScan.cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = walletScan.mapWallet.begin(); it != walletScan.mapWallet.end(); ++it)
+        setFound.insert(it->first);
+    BOOST_CHECK_EQUAL(nFound, (int)setFound.size());
+    return setFound;
+}
+
+BOOST_AUTO_TEST_CASE(rescan_parallel_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    // a chain spanning a few scan batches, paying us now and then and spending some of that again
+    CBlockIndex* pindexTipPrev;
+    CBlockIndex* pindexStart = NULL;
+    set<uint256> setExpected;
+    uint256 hashStale;
+    vector<CBlockIndex*> vIndexes;
+    {
+        LOCK(cs_main);
+        pindexTipPrev = chainActive.Tip();
+        CBlockIndex* pindex = pindexTipPrev;
+        CDiskBlockPos posWrite(9998, 0);
+        uint256 hashPayment;
+        for (unsigned int i = 0; i < 2 * WALLET_SCAN_BATCH_SIZE + 10; i++) {
+            CBlock block;
+            block.nTime = pindex->nTime + 1;
+
+            CMutableTransaction txCoinbase;
+            txCoinbase.vin.resize(1);
+            txCoinbase.vin[0].prevout.SetNull();
+            txCoinbase.vin[0].scriptSig = CScript() << (int64_t)i << OP_0;
+            txCoinbase.vout.resize(1);
+            txCoinbase.vout[0].nValue = 250 * COIN;
+            txCoinbase.vout[0].scriptPubKey = scriptOther;
+            block.vtx.push_back(txCoinbase);
+
+            if (i % 7 == 3) {
+                CMutableTransaction txPay;
+                txPay.vin.resize(1);
+                txPay.vin[0].prevout = COutPoint(GetRandHash(), 0);
+                txPay.vout.resize(2);
+                txPay.vout[0].nValue = (i + 1) * COIN;
+                txPay.vout[0].scriptPubKey = scriptOther;
+                txPay.vout[1].nValue = COIN;
+                txPay.vout[1].scriptPubKey = scriptMine;
+                block.vtx.push_back(txPay);
+                hashPayment = txPay.GetHash();
+                setExpected.insert(hashPayment);
+            } else if (i % 7 == 5) {
+                CMutableTransaction txSpend;
+                txSpend.vin.resize(1);
+                txSpend.vin[0].prevout = COutPoint(hashPayment, 1);
+                txSpend.vout.resize(1);
+                txSpend.vout[0].nValue = COIN / 2;
+                txSpend.vout[0].scriptPubKey = scriptOther;
+                block.vtx.push_back(txSpend);
+                setExpected.insert(txSpend.GetHash());
+            }
+
+            // a block paying us that was disconnected again, its payment must not be found
+            if (i == WALLET_SCAN_BATCH_SIZE) {
+                CBlock blockStale = block;
+                CMutableTransaction txStale;
+                txStale.vin.resize(1);
+                txStale.vin[0].prevout = COutPoint(GetRandHash(), 0);
+                txStale.vout.resize(1);
+                txStale.vout[0].nValue = 7 * COIN;
+                txStale.vout[0].scriptPubKey = scriptMine;
+                blockStale.vtx.push_back(txStale);
+                hashStale = txStale.GetHash();
+                vIndexes.push_back(add_scan_block(blockStale, pindex, posWrite));
+            }
+
+            pindex = add_scan_block(block, pindex, posWrite);
+            vIndexes.push_back(pindex);
+            if (!pindexStart)
+                pindexStart = pindex;
+        }
+        chainActive.SetTip(pindex);
+    }
+
+    set<uint256> setSerial = scan_wallet(key, pindexStart, 0);
+    set<uint256> setParallel = scan_wallet(key, pindexStart, 3);
+    BOOST_CHECK(setSerial == setExpected);
+    BOOST_CHECK(setParallel == setSerial);
+    BOOST_CHECK(!setParallel.count(hashStale));
+
+    LOCK(cs_main);
+    chainActive.SetTip(pindexTipPrev);
+    BOOST_FOREACH (CBlockIndex* pindex, vIndexes) {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
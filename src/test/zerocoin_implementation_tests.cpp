@@ -263,6 +263,72 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     BOOST_CHECK_MESSAGE(strError == "Transaction spend more than was redeemed in zerocoins", str);
 }
 
+BOOST_AUTO_TEST_CASE(zerocoinspend_checkqueue_tests)
+{
+    cout << "Running zerocoinspend_checkqueue_tests...\n";
+
+    SelectParams(CBaseChainParams::MAIN);
+    CBigNum bnpubcoin;
+    BOOST_CHECK(bnpubcoin.SetHexBool(rawTxpub1));
+    PublicCoin pubCoin(Params().Zerocoin_Params(), bnpubcoin, CoinDenomination::ZQ_ONE);
+
+    // accumulate the three test mints; the accumulator after the first one alone is a valid but wrong value
+    Accumulator accumulator(Params().Zerocoin_Params(), CoinDenomination::ZQ_ONE);
+    AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoin);
+    CBigNum bnAccumulatorPartial;
+    CValidationState state;
+    for (pair<string, string> raw : vecRawMints) {
+        CTransaction tx;
+        BOOST_CHECK(DecodeHexTx(tx, raw.first));
+        for (const CTxOut out : tx.vout) {
+            if (!out.scriptPubKey.empty() && out.scriptPubKey.IsZerocoinMint()) {
+                PublicCoin publicCoin(Params().Zerocoin_Params());
+                BOOST_CHECK(TxOutToPublicCoin(out, publicCoin, state));
+                accumulator += publicCoin;
+                witness += publicCoin;
+            }
+        }
+        if (bnAccumulatorPartial == 0)
+            bnAccumulatorPartial = accumulator.getValue();
+    }
+
+    PrivateCoin privateCoin(Params().Zerocoin_Params(), pubCoin.getDenomination());
+    privateCoin.setPublicCoin(pubCoin);
+    privateCoin.setRandomness(CBigNum(rawTxRand1));
+    privateCoin.setSerialNumber(CBigNum(rawTxSerial1));
+    uint32_t nChecksum = GetChecksum(accumulator.getValue());
+    CoinSpend coinSpend(Params().Zerocoin_Params(), privateCoin, accumulator, nChecksum, witness, 0);
+
+    CDataStream ssSpend(SER_NETWORK, PROTOCOL_VERSION);
+    ssSpend << coinSpend;
+    std::vector<unsigned char> data(ssSpend.begin(), ssSpend.end());
+    CTxIn txin;
+    txin.nSequence = 1;
+    txin.scriptSig = CScript() << OP_ZEROCOINSPEND << data.size();
+    txin.scriptSig.insert(txin.scriptSig.end(), data.begin(), data.end());
+    txin.prevout.SetNull();
+
+    // TestingSetup starts the zerocoin check threads, so batches of two or more go through the queue
+    std::vector<CZerocoinSpendCheck> vChecks;
+    for (int i = 0; i < 3; i++)
+        vChecks.push_back(CZerocoinSpendCheck(txin, nChecksum, accumulator.getValue(), false));
+    BOOST_CHECK(RunZerocoinSpendChecks(vChecks));
+
+    // one spend checked against the wrong accumulator fails the whole batch, wherever it sits
+    for (int nBad = 0; nBad < 3; nBad++) {
+        vChecks.clear();
+        for (int i = 0; i < 3; i++)
+            vChecks.push_back(CZerocoinSpendCheck(txin, nChecksum, i == nBad ? bnAccumulatorPartial : accumulator.getValue(), false));
+        BOOST_CHECK(!RunZerocoinSpendChecks(vChecks));
+    }
+
+    // the queue is reusable after a failed batch
+    vChecks.clear();
+    for (int i = 0; i < 2; i++)
+        vChecks.push_back(CZerocoinSpendCheck(txin, nChecksum, accumulator.getValue(), false));
+    BOOST_CHECK(RunZerocoinSpendChecks(vChecks));
+}
+
 
 BOOST_AUTO_TEST_CASE(setup_exceptions_test)
 {
@@ -348,5 +414,155 @@ BOOST_AUTO_TEST_CASE(checksum_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_zerocoin_serialization_tests)
+{
+    cout << "Running blockindex_zerocoin_serialization_tests\n";
+
+    // the compact block index fields must stay readable by and from the map/vector disk format
+    std::map<CoinDenomination, int64_t> mapSupply;
+    std::vector<CoinDenomination> vMints = {ZQ_FIFTY, ZQ_ONE, ZQ_FIFTY};
+    CZerocoinSupply supply;
+    CZerocoinMintCounts mints;
+    int64_t n = 3;
+    for (auto& denom : zerocoinDenomList) {
+        mapSupply[denom] = n;
+        supply.at(denom) = n;
+        n *= 7;
+    }
+    std::sort(vMints.begin(), vMints.end());
+    for (auto& denom : vMints)
+        mints.Add(denom);
+
+    CDataStream ssMap(SER_DISK, CLIENT_VERSION), ssSupply(SER_DISK, CLIENT_VERSION);
+    ssMap << mapSupply << vMints;
+    ssSupply << supply << mints;
+    BOOST_CHECK(ssMap.str() == ssSupply.str());
+    BOOST_CHECK_EQUAL(ssSupply.size(), ::GetSerializeSize(supply, SER_DISK, CLIENT_VERSION) + ::GetSerializeSize(mints, SER_DISK, CLIENT_VERSION));
+
+    CZerocoinSupply supplyRead;
+    CZerocoinMintCounts mintsRead;
+    ssMap >> supplyRead >> mintsRead;
+    for (auto& denom : zerocoinDenomList) {
+        BOOST_CHECK_EQUAL(supplyRead.at(denom), mapSupply[denom]);
+        BOOST_CHECK_EQUAL(mintsRead.Count(denom), std::count(vMints.begin(), vMints.end(), denom));
+    }
+    BOOST_CHECK_THROW(supplyRead.at(ZQ_ERROR), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(witness_resume_tests)
+{
+    cout << "Running witness_resume_tests\n";
+
+    SelectParams(CBaseChainParams::MAIN);
+    ZerocoinParams *ZCParams = Params().Zerocoin_Params();
+
+    // the first block holds our mint and two others, later blocks hold further mints of the denomination
+    std::vector<std::list<PublicCoin> > vBlocks(6);
+    CValidationState state;
+    for (pair<string, string> raw : vecRawMints) {
+        CTransaction tx;
+        BOOST_CHECK(DecodeHexTx(tx, raw.first));
+        for (const CTxOut out : tx.vout) {
+            PublicCoin pubcoin(ZCParams);
+            if (!out.scriptPubKey.empty() && out.scriptPubKey.IsZerocoinMint() && TxOutToPublicCoin(out, pubcoin, state))
+                vBlocks[0].push_back(pubcoin);
+        }
+    }
+    BOOST_CHECK_EQUAL(vBlocks[0].size(), 3);
+    for (unsigned int i = 1; i < vBlocks.size(); i++) {
+        for (unsigned int n = 0; n < i % 3; n++)
+            vBlocks[i].push_back(PublicCoin(ZCParams, CBigNum(1000 + 10 * i + n), ZQ_ONE));
+    }
+    const PublicCoin coin = vBlocks[0].front();
+
+    CAccumulatorWitnessSnapshot snapshotStart;
+    snapshotStart.nHeight = 100;
+    snapshotStart.bnWitness = ZCParams->accumulatorParams.accumulatorBase;
+
+    // from scratch, in one walk
+    CAccumulatorWitnessSnapshot snapshotScratch = snapshotStart;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        AddBlockToWitnessSnapshot(coin, i == 0, vBlocks[i], uint256(i + 1), snapshotScratch);
+
+    // resumed: stop half way, store the snapshot as the wallet does, then continue from the stored copy
+    CAccumulatorWitnessSnapshot snapshotFirst = snapshotStart;
+    for (unsigned int i = 0; i < 3; i++)
+        AddBlockToWitnessSnapshot(coin, i == 0, vBlocks[i], uint256(i + 1), snapshotFirst);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << snapshotFirst;
+    CAccumulatorWitnessSnapshot snapshotResumed;
+    ss >> snapshotResumed;
+    for (unsigned int i = 3; i < vBlocks.size(); i++)
+        AddBlockToWitnessSnapshot(coin, false, vBlocks[i], uint256(i + 1), snapshotResumed);
+
+    BOOST_CHECK(snapshotResumed.bnWitness == snapshotScratch.bnWitness);
+    BOOST_CHECK_EQUAL(snapshotResumed.nMintsAdded, snapshotScratch.nMintsAdded);
+    BOOST_CHECK_EQUAL(snapshotResumed.nHeight, snapshotStart.nHeight + (int)vBlocks.size());
+    BOOST_CHECK(snapshotResumed.hashBlockPrev == uint256(vBlocks.size()));
+
+    // both equal the libzerocoin witness over every mint but our own
+    Accumulator accumulator(ZCParams, ZQ_ONE);
+    AccumulatorWitness witness(ZCParams, accumulator, coin);
+    int nMints = 0;
+    for (const std::list<PublicCoin>& listPubcoins : vBlocks) {
+        for (const PublicCoin& pubcoin : listPubcoins) {
+            if (pubcoin.getValue() == coin.getValue())
+                continue;
+            witness.addRawValue(pubcoin.getValue());
+            nMints++;
+        }
+    }
+    BOOST_CHECK(witness.getValue() == snapshotScratch.bnWitness);
+    BOOST_CHECK_EQUAL(snapshotScratch.nMintsAdded, nMints);
+}
+
+BOOST_AUTO_TEST_CASE(block_pubcoins_tests)
+{
+    cout << "Running block_pubcoins_tests\n";
+
+    SelectParams(CBaseChainParams::MAIN);
+    ZerocoinParams *ZCParams = Params().Zerocoin_Params();
+    CZerocoinDB db(1 << 20, true, true);
+
+    uint256 hashBlock = uint256("0x1");
+    std::list<PublicCoin> listPubcoins;
+    listPubcoins.emplace_back(PublicCoin(ZCParams, CBigNum(101), ZQ_ONE));
+    listPubcoins.emplace_back(PublicCoin(ZCParams, CBigNum(102), ZQ_FIVE));
+    listPubcoins.emplace_back(PublicCoin(ZCParams, CBigNum(103), ZQ_ONE));
+    BOOST_CHECK(db.WriteBlockPubcoins(255, hashBlock, listPubcoins));
+    BOOST_CHECK(db.WriteBlockPubcoins(256, uint256("0x2"), std::list<PublicCoin>()));
+
+    // a block that has not been indexed, or another block at the same height, is not found
+    std::list<PublicCoin> listRead;
+    BOOST_CHECK(!db.ReadBlockPubcoins(254, hashBlock, listRead));
+    BOOST_CHECK(!db.ReadBlockPubcoins(255, uint256("0x2"), listRead));
+
+    BOOST_CHECK(db.ReadBlockPubcoins(255, hashBlock, listRead));
+    BOOST_CHECK_EQUAL(listRead.size(), 3);
+
+    listRead.clear();
+    BOOST_CHECK(db.ReadBlockPubcoins(255, hashBlock, listRead, ZQ_ONE));
+    BOOST_CHECK_EQUAL(listRead.size(), 2);
+    for (const PublicCoin& pubcoin : listRead)
+        BOOST_CHECK(pubcoin.getDenomination() == ZQ_ONE);
+
+    // the neighbouring empty block does not pick up any pubcoins
+    listRead.clear();
+    BOOST_CHECK(db.ReadBlockPubcoins(256, uint256("0x2"), listRead));
+    BOOST_CHECK(listRead.empty());
+
+    // reindexing a height replaces the previous entries
+    std::list<PublicCoin> listReplaced;
+    listReplaced.emplace_back(PublicCoin(ZCParams, CBigNum(104), ZQ_TEN));
+    BOOST_CHECK(db.WriteBlockPubcoins(255, uint256("0x3"), listReplaced));
+    listRead.clear();
+    BOOST_CHECK(db.ReadBlockPubcoins(255, uint256("0x3"), listRead));
+    BOOST_CHECK_EQUAL(listRead.size(), 1);
+    BOOST_CHECK(listRead.front().getValue() == CBigNum(104));
+
+    BOOST_CHECK(db.EraseBlockPubcoins(255));
+    BOOST_CHECK(!db.ReadBlockPubcoins(255, uint256("0x3"), listRead));
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
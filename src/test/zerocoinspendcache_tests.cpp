@@ -0,0 +1,66 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the verified zerocoin spend cache
+//
+
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "zerocoinspendcache.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(zerocoinspendcache_tests)
+
+static CTxIn MakeSpendTxIn(int n)
+{
+    CTxIn txin;
+    txin.scriptSig = CScript() << OP_ZEROCOINSPEND << n;
+    txin.prevout.SetNull();
+    return txin;
+}
+
+BOOST_AUTO_TEST_CASE(zerocoinspendcache_hit_miss)
+{
+    CTxIn txin = MakeSpendTxIn(1);
+    BOOST_CHECK(!IsZerocoinSpendVerified(txin, 1000));
+
+    SetZerocoinSpendVerified(txin, 1000);
+    BOOST_CHECK(IsZerocoinSpendVerified(txin, 1000));
+
+    // the same spend against another accumulator, or another spend, is a miss
+    BOOST_CHECK(!IsZerocoinSpendVerified(txin, 1001));
+    BOOST_CHECK(!IsZerocoinSpendVerified(MakeSpendTxIn(2), 1000));
+}
+
+BOOST_AUTO_TEST_CASE(zerocoinspendcache_eviction)
+{
+    const int nMaxSize = 10;
+    mapArgs["-maxzerocoinspendcachesize"] = itostr(nMaxSize);
+
+    // fill well past the limit, the newest entry always survives
+    for (int i = 0; i < 3 * nMaxSize; i++) {
+        SetZerocoinSpendVerified(MakeSpendTxIn(100 + i), 2000);
+        BOOST_CHECK(IsZerocoinSpendVerified(MakeSpendTxIn(100 + i), 2000));
+    }
+
+    int nHits = 0;
+    for (int i = 0; i < 3 * nMaxSize; i++)
+        if (IsZerocoinSpendVerified(MakeSpendTxIn(100 + i), 2000))
+            nHits++;
+    BOOST_CHECK(nHits > 0);
+    BOOST_CHECK(nHits <= nMaxSize);
+
+    // a size of zero turns caching off
+    mapArgs["-maxzerocoinspendcachesize"] = "0";
+    SetZerocoinSpendVerified(MakeSpendTxIn(500), 2000);
+    BOOST_CHECK(!IsZerocoinSpendVerified(MakeSpendTxIn(500), 2000));
+
+    mapArgs.erase("-maxzerocoinspendcachesize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
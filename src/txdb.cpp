@@ -10,6 +10,7 @@
 #include "pow.h"
 #include "uint256.h"
 #include "accumulators.h"
+#include "crypto/common.h"
 
 #include <stdint.h>
 
@@ -83,6 +84,14 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::WriteBlockIndexes(const std::vector<const CBlockIndex*>& vpindex)
+{
+    CLevelDBBatch batch;
+    for (const CBlockIndex* pindex : vpindex)
+        batch.Write(make_pair('b', pindex->GetBlockHash()), CDiskBlockIndex(pindex));
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo& info)
 {
     return Write(make_pair('f', nFile), info);
@@ -249,8 +258,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
                 //zerocoin
                 pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
+                pindexNew->zerocoinSupply = diskindex.zerocoinSupply;
+                pindexNew->mintsInBlock = diskindex.mintsInBlock;
 
                 //Proof Of Stake
                 pindexNew->nMint = diskindex.nMint;
@@ -365,3 +374,121 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(make_pair('a', nChecksum));
 }
+
+/** A block height serialized as 4 big endian bytes, so that keys holding it sort by height on any host */
+struct CPubcoinsKeyHeight
+{
+    unsigned char vchHeight[4];
+
+    CPubcoinsKeyHeight(int nHeight = 0)
+    {
+        WriteBE32(vchHeight, (uint32_t)nHeight);
+    }
+
+    int GetHeight() const { return (int)ReadBE32(vchHeight); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(FLATDATA(vchHeight));
+    }
+};
+
+// The entries of consecutive blocks are adjacent in the database.
+// Denomination ZQ_ERROR holds the hash of the indexed block and sorts before the real denominations.
+static std::pair<char, std::pair<CPubcoinsKeyHeight, int> > BlockPubcoinsKey(int nHeight, int nDenom)
+{
+    return make_pair('p', make_pair(CPubcoinsKeyHeight(nHeight), nDenom));
+}
+
+static bool ReadBlockPubcoinsRange(CLevelDBWrapper& db, int nHeight, std::map<int, std::vector<CBigNum> >& mapPubcoins, uint256& hashBlock)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << BlockPubcoinsKey(nHeight, ZQ_ERROR);
+    pcursor->Seek(ssKeySet.str());
+
+    bool fFound = false;
+    while (pcursor->Valid()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            std::pair<CPubcoinsKeyHeight, int> key;
+            ssKey >> chType;
+            if (chType != 'p')
+                break;
+            ssKey >> key;
+            if (key.first.GetHeight() != nHeight)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            if (key.second == ZQ_ERROR) {
+                ssValue >> hashBlock;
+                fFound = true;
+            } else {
+                ssValue >> mapPubcoins[key.second];
+            }
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return fFound;
+}
+
+bool CZerocoinDB::WriteBlockPubcoins(int nHeight, const uint256& hashBlock, const std::list<PublicCoin>& listPubcoins)
+{
+    CLevelDBBatch batch;
+
+    // drop what is left from a block that was previously indexed at this height
+    std::map<int, std::vector<CBigNum> > mapOld;
+    uint256 hashOld;
+    ReadBlockPubcoinsRange(*this, nHeight, mapOld, hashOld);
+    for (const auto& it : mapOld)
+        batch.Erase(BlockPubcoinsKey(nHeight, it.first));
+
+    std::map<int, std::vector<CBigNum> > mapPubcoins;
+    for (const PublicCoin& pubcoin : listPubcoins)
+        mapPubcoins[pubcoin.getDenomination()].push_back(pubcoin.getValue());
+    for (const auto& it : mapPubcoins)
+        batch.Write(BlockPubcoinsKey(nHeight, it.first), it.second);
+    batch.Write(BlockPubcoinsKey(nHeight, ZQ_ERROR), hashBlock);
+
+    return WriteBatch(batch);
+}
+
+bool CZerocoinDB::ReadBlockPubcoins(int nHeight, const uint256& hashBlock, std::list<PublicCoin>& listPubcoins, CoinDenomination denom)
+{
+    std::map<int, std::vector<CBigNum> > mapPubcoins;
+    uint256 hashIndexed;
+    if (!ReadBlockPubcoinsRange(*this, nHeight, mapPubcoins, hashIndexed) || hashIndexed != hashBlock)
+        return false;
+
+    for (const auto& it : mapPubcoins) {
+        if (denom != ZQ_ERROR && it.first != denom)
+            continue;
+        for (const CBigNum& bnValue : it.second)
+            listPubcoins.emplace_back(PublicCoin(Params().Zerocoin_Params(), bnValue, (CoinDenomination)it.first));
+    }
+
+    return true;
+}
+
+bool CZerocoinDB::EraseBlockPubcoins(int nHeight)
+{
+    CLevelDBBatch batch;
+    std::map<int, std::vector<CBigNum> > mapPubcoins;
+    uint256 hashBlock;
+    ReadBlockPubcoinsRange(*this, nHeight, mapPubcoins, hashBlock);
+    for (const auto& it : mapPubcoins)
+        batch.Erase(BlockPubcoinsKey(nHeight, it.first));
+    batch.Erase(BlockPubcoinsKey(nHeight, ZQ_ERROR));
+
+    return WriteBatch(batch);
+}
@@ -12,6 +12,7 @@
 #include "main.h"
 #include "primitives/zerocoin.h"
 
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -55,6 +56,7 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool WriteBlockIndexes(const std::vector<const CBlockIndex*>& vpindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
@@ -89,6 +91,11 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+
+    /** Pubcoins minted in the block at a height, keyed by (height, denomination) so a block's mints are one key range */
+    bool WriteBlockPubcoins(int nHeight, const uint256& hashBlock, const std::list<libzerocoin::PublicCoin>& listPubcoins);
+    bool ReadBlockPubcoins(int nHeight, const uint256& hashBlock, std::list<libzerocoin::PublicCoin>& listPubcoins, libzerocoin::CoinDenomination denom = libzerocoin::ZQ_ERROR);
+    bool EraseBlockPubcoins(int nHeight);
 };
 
 #endif // BITCOIN_TXDB_H
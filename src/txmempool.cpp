@@ -16,18 +16,43 @@
 
 #include <boost/circular_buffer.hpp>
 
+#include <math.h>
+
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+/** Rough heap footprint of a pool entry: the entry and its transaction's vectors, plus its node in mapTx,
+ *  setByDescendantScore, setByAncestorScore, setByEntryTime and for spends setZerocoinSpends, and one
+ *  mapNextTx node per input */
+static size_t EstimateEntryUsage(const CTransaction& tx)
+{
+    size_t nUsage = sizeof(CTxMemPoolEntry) + sizeof(uint256) + 2 * sizeof(std::pair<double, uint256>) +
+                    sizeof(std::pair<int64_t, uint256>) + 4 * 4 * sizeof(void*);
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        nUsage += sizeof(CTxIn) + txin.scriptSig.size() + sizeof(std::pair<const COutPoint, CInPoint>) + 4 * sizeof(void*);
+    BOOST_FOREACH (const CTxOut& txout, tx.vout)
+        nUsage += sizeof(CTxOut) + txout.scriptPubKey.size();
+    if (tx.IsZerocoinSpend())
+        nUsage += sizeof(uint256) + 4 * sizeof(void*);
+    return nUsage;
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0), nUsageSize(0), nFeeDelta(0),
+                                     nCountWithAncestors(0), nSizeWithAncestors(0), nFeesWithAncestors(0),
+                                     nCountWithDescendants(0), nSizeWithDescendants(0), nFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+    nUsageSize = EstimateEntryUsage(tx);
+
+    nCountWithAncestors = nCountWithDescendants = 1;
+    nSizeWithAncestors = nSizeWithDescendants = nTxSize;
+    nFeesWithAncestors = nFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -44,6 +69,27 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta)
+{
+    nCountWithAncestors += nCountDelta;
+    nSizeWithAncestors += nSizeDelta;
+    nFeesWithAncestors += nFeesDelta;
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta)
+{
+    nCountWithDescendants += nCountDelta;
+    nSizeWithDescendants += nSizeDelta;
+    nFeesWithDescendants += nFeesDelta;
+}
+
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount nNewFeeDelta)
+{
+    nFeesWithAncestors += nNewFeeDelta - nFeeDelta;
+    nFeesWithDescendants += nNewFeeDelta - nFeeDelta;
+    nFeeDelta = nNewFeeDelta;
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -357,7 +403,12 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedUsage(0),
+                                                       lastRollingFeeUpdate(GetTime()),
+                                                       blockSinceLastRollingFeeBump(false),
+                                                       rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -403,6 +454,116 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+void CTxMemPool::CalculateAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const
+{
+    std::deque<const CTransaction*> vWork(1, &tx);
+    while (!vWork.empty()) {
+        const CTransaction* ptx = vWork.front();
+        vWork.pop_front();
+        BOOST_FOREACH (const CTxIn& txin, ptx->vin) {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it != mapTx.end() && setAncestors.insert(it->first).second)
+                vWork.push_back(&it->second.GetTx());
+        }
+    }
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, std::set<uint256>& setAncestors, uint64_t limitAncestorCount,
+    uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString) const
+{
+    uint64_t totalSizeWithAncestors = entry.GetTxSize();
+    std::deque<const CTransaction*> vWork(1, &entry.GetTx());
+    while (!vWork.empty()) {
+        const CTransaction* ptx = vWork.front();
+        vWork.pop_front();
+        BOOST_FOREACH (const CTxIn& txin, ptx->vin) {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it == mapTx.end() || !setAncestors.insert(it->first).second)
+                continue;
+            const CTxMemPoolEntry& ancestor = it->second;
+            if (ancestor.GetCountWithDescendants() + 1 > limitDescendantCount) {
+                errString = strprintf("too many descendants for tx %s [limit: %u]", it->first.ToString(), limitDescendantCount);
+                return false;
+            }
+            if (ancestor.GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+                errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", it->first.ToString(), limitDescendantSize);
+                return false;
+            }
+            totalSizeWithAncestors += ancestor.GetTxSize();
+            if (setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+            if (totalSizeWithAncestors > limitAncestorSize) {
+                errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+                return false;
+            }
+            vWork.push_back(&ancestor.GetTx());
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    std::deque<uint256> vWork(1, hash);
+    while (!vWork.empty()) {
+        uint256 hashParent = vWork.front();
+        vWork.pop_front();
+        std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.lower_bound(COutPoint(hashParent, 0));
+        for (; it != mapNextTx.end() && it->first.hash == hashParent; ++it) {
+            const uint256& hashChild = it->second.ptx->GetHash();
+            if (setDescendants.insert(hashChild).second)
+                vWork.push_back(hashChild);
+        }
+    }
+}
+
+void CTxMemPool::UpdateEntry(std::map<uint256, CTxMemPoolEntry>::iterator it, int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta, bool fAncestor)
+{
+    CTxMemPoolEntry& entry = it->second;
+    if (fAncestor) {
+        // the ancestor state is the key of setByAncestorScore
+        setByAncestorScore.erase(make_pair(entry.GetAncestorScore(), it->first));
+        entry.UpdateAncestorState(nCountDelta, nSizeDelta, nFeesDelta);
+        setByAncestorScore.insert(make_pair(entry.GetAncestorScore(), it->first));
+        return;
+    }
+    // the descendant state is the key of setByDescendantScore
+    setByDescendantScore.erase(make_pair(entry.GetDescendantScore(), it->first));
+    entry.UpdateDescendantState(nCountDelta, nSizeDelta, nFeesDelta);
+    setByDescendantScore.insert(make_pair(entry.GetDescendantScore(), it->first));
+}
+
+void CTxMemPool::RecalculateEntry(const uint256& hash)
+{
+    std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+    const CTxMemPoolEntry& entry = it->second;
+
+    std::set<uint256> setAncestors;
+    CalculateAncestors(entry.GetTx(), setAncestors);
+    int64_t nCount = 1, nSize = entry.GetTxSize();
+    CAmount nFees = entry.GetModifiedFee();
+    BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+        const CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+        nCount++;
+        nSize += ancestor.GetTxSize();
+        nFees += ancestor.GetModifiedFee();
+    }
+    UpdateEntry(it, nCount - entry.GetCountWithAncestors(), nSize - entry.GetSizeWithAncestors(), nFees - entry.GetFeesWithAncestors(), true);
+
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    nCount = 1, nSize = entry.GetTxSize(), nFees = entry.GetModifiedFee();
+    BOOST_FOREACH (const uint256& hashDescendant, setDescendants) {
+        const CTxMemPoolEntry& descendant = mapTx.find(hashDescendant)->second;
+        nCount++;
+        nSize += descendant.GetTxSize();
+        nFees += descendant.GetModifiedFee();
+    }
+    UpdateEntry(it, nCount - entry.GetCountWithDescendants(), nSize - entry.GetSizeWithDescendants(), nFees - entry.GetFeesWithDescendants(), false);
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
 {
     // Add to memory pool without checking anything.
@@ -410,18 +571,92 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        if (mapTx.count(hash)) {
+            std::list<CTransaction> dummy;
+            remove(mapTx[hash].GetTx(), dummy, false);
+        }
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.insert(make_pair(hash, entry)).first;
+        const CTransaction& tx = it->second.GetTx();
+        // Fee deltas given to the transaction before it arrived count from the start
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+        if (pos != mapDeltas.end() && pos->second.second)
+            it->second.UpdateFeeDelta(pos->second.second);
         if(!tx.IsZerocoinSpend()) {
             for (unsigned int i = 0; i < tx.vin.size(); i++)
                 mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         }
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+        cachedUsage += entry.GetUsageSize();
+        setByDescendantScore.insert(make_pair(it->second.GetDescendantScore(), hash));
+        setByAncestorScore.insert(make_pair(it->second.GetAncestorScore(), hash));
+        setByEntryTime.insert(make_pair(entry.GetTime(), hash));
+        if (tx.IsZerocoinSpend())
+            setZerocoinSpends.insert(hash);
+
+        std::set<uint256> setAncestors;
+        CalculateAncestors(tx, setAncestors);
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        if (setDescendants.empty()) {
+            // The usual case: a new leaf only adds itself to the descendant state of its ancestors
+            BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+                std::map<uint256, CTxMemPoolEntry>::iterator itAncestor = mapTx.find(hashAncestor);
+                UpdateEntry(itAncestor, 1, entry.GetTxSize(), it->second.GetModifiedFee(), false);
+                UpdateEntry(it, 1, itAncestor->second.GetTxSize(), itAncestor->second.GetModifiedFee(), true);
+            }
+        } else {
+            // Re-added underneath transactions already in the pool (after a reorg), recount everything it links
+            RecalculateEntry(hash);
+            BOOST_FOREACH (const uint256& hashAncestor, setAncestors)
+                RecalculateEntry(hashAncestor);
+            BOOST_FOREACH (const uint256& hashDescendant, setDescendants)
+                RecalculateEntry(hashDescendant);
+        }
     }
     return true;
 }
 
+void CTxMemPool::removeUnchecked(const std::vector<uint256>& vRemove, std::list<CTransaction>& removed)
+{
+    AssertLockHeld(cs);
+    std::set<uint256> setRemove(vRemove.begin(), vRemove.end());
+
+    // Take the removed transactions out of the aggregates of what stays, while all links are still in place
+    BOOST_FOREACH (const uint256& hash, vRemove) {
+        const CTxMemPoolEntry& entry = mapTx.find(hash)->second;
+        std::set<uint256> setAncestors;
+        CalculateAncestors(entry.GetTx(), setAncestors);
+        BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+            if (!setRemove.count(hashAncestor))
+                UpdateEntry(mapTx.find(hashAncestor), -1, -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee(), false);
+        }
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        BOOST_FOREACH (const uint256& hashDescendant, setDescendants) {
+            if (!setRemove.count(hashDescendant))
+                UpdateEntry(mapTx.find(hashDescendant), -1, -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee(), true);
+        }
+    }
+
+    BOOST_FOREACH (const uint256& hash, vRemove) {
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        const CTxMemPoolEntry& entry = it->second;
+        const CTransaction& tx = entry.GetTx();
+        BOOST_FOREACH (const CTxIn& txin, tx.vin)
+            mapNextTx.erase(txin.prevout);
+
+        removed.push_back(tx);
+        totalTxSize -= entry.GetTxSize();
+        cachedUsage -= entry.GetUsageSize();
+        setByDescendantScore.erase(make_pair(entry.GetDescendantScore(), hash));
+        setByAncestorScore.erase(make_pair(entry.GetAncestorScore(), hash));
+        setByEntryTime.erase(make_pair(entry.GetTime(), hash));
+        setZerocoinSpends.erase(hash);
+        mapTx.erase(it);
+        nTransactionsUpdated++;
+    }
+}
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
@@ -442,28 +677,24 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<uint256> vRemove;
+        std::set<uint256> setRemove;
         while (!txToRemove.empty()) {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            if (!mapTx.count(hash) || !setRemove.insert(hash).second)
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
             if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                for (unsigned int i = 0; i < mapTx[hash].GetTx().vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
                         continue;
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
-            BOOST_FOREACH (const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
+            vRemove.push_back(hash);
         }
+        removeUnchecked(vRemove, removed);
     }
 }
 
@@ -527,6 +758,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
@@ -535,10 +768,100 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setByDescendantScore.clear();
+    setByAncestorScore.clear();
+    setByEntryTime.clear();
+    setZerocoinSpends.clear();
     totalTxSize = 0;
+    cachedUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
+int CTxMemPool::Expire(int64_t nTime)
+{
+    LOCK(cs);
+    std::vector<uint256> vRemove;
+    std::set<uint256> setRemove;
+    std::set<std::pair<int64_t, uint256> >::const_iterator it = setByEntryTime.begin();
+    for (; it != setByEntryTime.end() && it->first < nTime; ++it) {
+        std::set<uint256> setDescendants;
+        CalculateDescendants(it->second, setDescendants);
+        setDescendants.insert(it->second);
+        BOOST_FOREACH (const uint256& hash, setDescendants) {
+            if (setRemove.insert(hash).second)
+                vRemove.push_back(hash);
+        }
+    }
+    std::list<CTransaction> removed;
+    removeUnchecked(vRemove, removed);
+    return removed.size();
+}
+
+void CTxMemPool::TrimToSize(size_t nSizeLimit, std::list<CTransaction>* pvRemoved)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    while (!setByDescendantScore.empty() && cachedUsage > nSizeLimit) {
+        // the package with the lowest fee rate goes first, its descendants cannot stay without it
+        uint256 hash = setByDescendantScore.begin()->second;
+        const CTxMemPoolEntry& entry = mapTx.find(hash)->second;
+        // whatever takes its place has to pay more than the package did, by at least the relay fee
+        CFeeRate rateRemoved(entry.GetFeesWithDescendants(), entry.GetSizeWithDescendants());
+        trackPackageRemoved(CFeeRate(rateRemoved.GetFeePerK() + minRelayFee.GetFeePerK()));
+
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        std::vector<uint256> vRemove(1, hash);
+        vRemove.insert(vRemove.end(), setDescendants.begin(), setDescendants.end());
+
+        std::list<CTransaction> removed;
+        removeUnchecked(vRemove, removed);
+        nTxnRemoved += removed.size();
+        if (pvRemoved)
+            pvRemoved->splice(pvRemoved->end(), removed);
+    }
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn to keep the mempool under %u bytes\n", nTxnRemoved, nSizeLimit);
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(llround(rollingMinimumFeeRate));
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        // decay faster the emptier the pool is
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (cachedUsage < sizelimit / 4)
+            halflife /= 4;
+        else if (cachedUsage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(llround(rollingMinimumFeeRate)), minRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
 void CTxMemPool::check(const CCoinsViewCache* pcoins) const
 {
     if (!fSanityCheck)
@@ -611,6 +934,45 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
 
     assert(totalTxSize == checkTotal);
+
+    uint64_t checkUsage = 0;
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTxMemPoolEntry& entry = it->second;
+        checkUsage += entry.GetUsageSize();
+        assert(setByDescendantScore.count(make_pair(entry.GetDescendantScore(), it->first)));
+        assert(setByAncestorScore.count(make_pair(entry.GetAncestorScore(), it->first)));
+        assert(setByEntryTime.count(make_pair(entry.GetTime(), it->first)));
+        assert(setZerocoinSpends.count(it->first) == (entry.GetTx().IsZerocoinSpend() ? 1U : 0U));
+
+        std::set<uint256> setAncestors;
+        CalculateAncestors(entry.GetTx(), setAncestors);
+        uint64_t nSize = entry.GetTxSize();
+        CAmount nFees = entry.GetModifiedFee();
+        BOOST_FOREACH (const uint256& hash, setAncestors) {
+            nSize += mapTx.find(hash)->second.GetTxSize();
+            nFees += mapTx.find(hash)->second.GetModifiedFee();
+        }
+        assert(entry.GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(entry.GetSizeWithAncestors() == nSize);
+        assert(entry.GetFeesWithAncestors() == nFees);
+
+        std::set<uint256> setDescendants;
+        CalculateDescendants(it->first, setDescendants);
+        nSize = entry.GetTxSize();
+        nFees = entry.GetModifiedFee();
+        BOOST_FOREACH (const uint256& hash, setDescendants) {
+            nSize += mapTx.find(hash)->second.GetTxSize();
+            nFees += mapTx.find(hash)->second.GetModifiedFee();
+        }
+        assert(entry.GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(entry.GetSizeWithDescendants() == nSize);
+        assert(entry.GetFeesWithDescendants() == nFees);
+    }
+    assert(setByDescendantScore.size() == mapTx.size());
+    assert(setByAncestorScore.size() == mapTx.size());
+    assert(setByEntryTime.size() == mapTx.size());
+    assert(setZerocoinSpends.size() <= mapTx.size());
+    assert(cachedUsage == checkUsage);
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -681,6 +1043,25 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+
+        // A transaction already in the pool moves in both score orderings, along with everything linked to it
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta) {
+            setByDescendantScore.erase(make_pair(it->second.GetDescendantScore(), hash));
+            setByAncestorScore.erase(make_pair(it->second.GetAncestorScore(), hash));
+            it->second.UpdateFeeDelta(deltas.second);
+            setByDescendantScore.insert(make_pair(it->second.GetDescendantScore(), hash));
+            setByAncestorScore.insert(make_pair(it->second.GetAncestorScore(), hash));
+
+            std::set<uint256> setAncestors;
+            CalculateAncestors(it->second.GetTx(), setAncestors);
+            BOOST_FOREACH (const uint256& hashAncestor, setAncestors)
+                UpdateEntry(mapTx.find(hashAncestor), 0, 0, nFeeDelta, false);
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH (const uint256& hashDescendant, setDescendants)
+                UpdateEntry(mapTx.find(hashDescendant), 0, 0, nFeeDelta, true);
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
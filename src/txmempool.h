@@ -9,6 +9,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -46,6 +47,16 @@ private:
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    size_t nUsageSize;    //! Estimated memory held by the entry and its mapTx/mapNextTx nodes
+    CAmount nFeeDelta;    //! Fee delta from prioritisetransaction, counted in the aggregates below
+
+    //! Aggregates over this entry and its in-pool ancestors/descendants, kept up to date by CTxMemPool
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nFeesWithAncestors;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nFeesWithDescendants;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -55,9 +66,27 @@ public:
     const CTransaction& GetTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    size_t GetUsageSize() const { return nUsageSize; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetFeesWithAncestors() const { return nFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetFeesWithDescendants() const { return nFeesWithDescendants; }
+
+    //! Fee rate of this entry together with its descendants, the eviction order of the pool
+    double GetDescendantScore() const { return (double)nFeesWithDescendants / nSizeWithDescendants; }
+    //! Fee rate of this entry together with its ancestors, the order blocks are filled in
+    double GetAncestorScore() const { return (double)nFeesWithAncestors / nSizeWithAncestors; }
+
+    void UpdateAncestorState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta);
+    void UpdateDescendantState(int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta);
+    void UpdateFeeDelta(CAmount nNewFeeDelta);
 };
 
 class CMinerPolicyEstimator;
@@ -102,12 +131,34 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedUsage; //! sum of all mempool entries' estimated memory usage
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! fee rate a transaction needs to enter a full pool, decays over time
+
+    //! Secondary orderings of mapTx: by descendant score for eviction, and by entry time for expiry
+    std::set<std::pair<double, uint256> > setByDescendantScore;
+    std::set<std::pair<int64_t, uint256> > setByEntryTime;
+
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+    void UpdateEntry(std::map<uint256, CTxMemPoolEntry>::iterator it, int64_t nCountDelta, int64_t nSizeDelta, CAmount nFeesDelta, bool fAncestor);
+    void RecalculateEntry(const uint256& hash);
+    void removeUnchecked(const std::vector<uint256>& vRemove, std::list<CTransaction>& removed);
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    //! Seconds for the rolling minimum fee to halve once blocks are being found again
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
+
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    //! mapTx ordered by ancestor score, kept sorted as transactions come and go for CreateNewBlock
+    std::set<std::pair<double, uint256> > setByAncestorScore;
+    //! The zerocoin spends in mapTx, which CreateNewBlock takes whatever their fee rate
+    std::set<uint256> setZerocoinSpends;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
@@ -122,12 +173,26 @@ public:
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    /** The in-pool transactions tx spends from, directly or further up. Requires cs */
+    void CalculateAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const;
+    /** CalculateAncestors for an entry about to be added, giving up with errString as soon as the entry's package
+     *  or that of any of its ancestors would outgrow a limit. Requires cs */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, std::set<uint256>& setAncestors, uint64_t limitAncestorCount,
+        uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString) const;
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+
+    /** Remove transactions that entered the pool before nTime, with their descendants. Returns the number removed */
+    int Expire(int64_t nTime);
+    /** Evict the lowest descendant score packages until the pool uses at most nSizeLimit bytes */
+    void TrimToSize(size_t nSizeLimit, std::list<CTransaction>* pvRemoved = NULL);
+    /** The fee rate a transaction needs to get into a pool limited to sizelimit bytes. It is raised above the
+     *  evicted packages by TrimToSize and decays again once blocks come in */
+    CFeeRate GetMinFee(size_t sizelimit) const;
     void pruneSpent(const uint256& hash, CCoins& coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -147,6 +212,12 @@ public:
         LOCK(cs);
         return totalTxSize;
     }
+    /** Estimated memory held by the pool's entries, the measure -maxmempool limits */
+    uint64_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return cachedUsage;
+    }
 
     bool exists(uint256 hash)
     {
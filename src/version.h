@@ -12,7 +12,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70025;
+static const int PROTOCOL_VERSION = 70026;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -20,6 +20,9 @@ static const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 static const int GETHEADERS_VERSION = 70000;
 
+//! "getheaders" is answered with "headers" rather than with block invs starting with this version
+static const int HEADERS_FIRST_VERSION = 70026;
+
 //! disconnect from peers older than this proto version
 static const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 70025;
 static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 70025;
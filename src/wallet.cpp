@@ -10,6 +10,7 @@
 #include "accumulators.h"
 #include "base58.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "kernel.h"
 #include "masternode-budget.h"
@@ -20,6 +21,7 @@
 #include "spork.h"
 #include "swifttx.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #include "utilmoneystr.h"
 
@@ -439,6 +441,19 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+bool CWallet::IsSpentInMainChain(const uint256& hash, unsigned int n) const
+{
+    const COutPoint outpoint(hash, n);
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) > 0)
+            return true;
+    }
+    return false;
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -651,6 +666,7 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
+        fBalancesLoaded = false;
         BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
             item.second.MarkDirty();
     }
@@ -745,6 +761,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        AddToStakeableCoins(wtx);
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -783,6 +801,25 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
+    bool fHaveMints;
+    {
+        LOCK(cs_wallet);
+        fHaveMints = !setZerocoinMintSerialHashes.empty();
+    }
+
+    // Let listeners know when one of our zerocoin mints gets spent
+    if (fHaveMints && tx.IsZerocoinSpend()) {
+        for (const CTxIn& txin : tx.vin) {
+            if (!txin.scriptSig.IsZerocoinSpend())
+                continue;
+            CBigNum bnSerial = TxInToZerocoinSpend(txin).getCoinSerialNumber();
+            if (IsMyZerocoinMintSerial(bnSerial)) {
+                LogPrintf("%s: %s detected spent zerocoin mint in transaction %s \n", __func__, bnSerial.GetHex(), tx.GetHash().GetHex());
+                NotifyZerocoinChanged(this, bnSerial.GetHex(), "Used", CT_UPDATED);
+            }
+        }
+    }
+
     LOCK2(cs_main, cs_wallet);
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
@@ -802,8 +839,14 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            // the outputs it spent are ours to stake again
+            AddToStakeableCoins(mi->second);
+            mapWallet.erase(mi);
+            MarkBalancesDirty(hash);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -1126,6 +1169,57 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+/** Read one block of a rescan and mark its transactions that pay to the wallet */
+class CWalletScanCheck
+{
+private:
+    const CWallet* pwallet;
+    const CBlockIndex* pindex;
+    CBlock* pblock;
+    std::vector<bool>* pvMatch;
+
+public:
+    CWalletScanCheck() : pwallet(NULL), pindex(NULL), pblock(NULL), pvMatch(NULL) {}
+    CWalletScanCheck(const CWallet* pwalletIn, const CBlockIndex* pindexIn, CBlock* pblockIn, std::vector<bool>* pvMatchIn) : pwallet(pwalletIn), pindex(pindexIn), pblock(pblockIn), pvMatch(pvMatchIn) {}
+
+    bool operator()()
+    {
+        // a block that cannot be read is skipped, as the sequential scan always did
+        if (!ReadBlockFromDisk(*pblock, pindex)) {
+            pblock->SetNull();
+            return true;
+        }
+
+        pvMatch->assign(pblock->vtx.size(), false);
+        for (unsigned int i = 0; i < pblock->vtx.size(); i++) {
+            BOOST_FOREACH (const CTxOut& txout, pblock->vtx[i].vout) {
+                if (pwallet->IsMine(txout) != ISMINE_NO) {
+                    (*pvMatch)[i] = true;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    void swap(CWalletScanCheck& check)
+    {
+        std::swap(pwallet, check.pwallet);
+        std::swap(pindex, check.pindex);
+        std::swap(pblock, check.pblock);
+        std::swap(pvMatch, check.pvMatch);
+    }
+};
+
+static CCheckQueue<CWalletScanCheck> walletscanqueue(8);
+static CCriticalSection cs_walletscanqueue;
+
+void ThreadWalletScan()
+{
+    RenameThread("umbra-walletscan");
+    walletscanqueue.Thread();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1137,6 +1231,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     int64_t nNow = GetTime();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1146,26 +1241,79 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex) {
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    // Blocks are read and their outputs matched against our keys a batch at a time on the
+    // wallet scan threads. Only then are the locks taken to add the matches in chain order,
+    // so cs_main is free between batches unless the caller holds it.
+    const CBlockIndex* pindexLast = NULL;
+    std::vector<CBlockIndex*> vBatch;
+    std::vector<CBlock> vBlocks;
+    std::vector<std::vector<bool> > vMatches;
+    while (true) {
+        vBatch.clear();
+        {
+            LOCK(cs_main);
+            // a reorganization while cs_main was released is passed to the wallet by SyncTransaction,
+            // so carry on from where the blocks scanned so far leave the active chain
+            if (pindexLast)
+                pindex = chainActive.Next(chainActive.FindFork(pindexLast));
+            for (; pindex && vBatch.size() < WALLET_SCAN_BATCH_SIZE; pindex = chainActive.Next(pindex))
+                vBatch.push_back(pindex);
+        }
+        if (vBatch.empty())
+            break;
+
+        vBlocks.assign(vBatch.size(), CBlock());
+        vMatches.assign(vBatch.size(), std::vector<bool>());
+        std::vector<CWalletScanCheck> vChecks;
+        vChecks.reserve(vBatch.size());
+        for (unsigned int i = 0; i < vBatch.size(); i++)
+            vChecks.push_back(CWalletScanCheck(this, vBatch[i], &vBlocks[i], &vMatches[i]));
+
+        if (nScriptCheckThreads) {
+            LOCK(cs_walletscanqueue);
+            CCheckQueueControl<CWalletScanCheck> control(&walletscanqueue);
+            control.Add(vChecks);
+            control.Wait();
+        } else {
+            BOOST_FOREACH (CWalletScanCheck& check, vChecks)
+                check();
+        }
+
+        LOCK2(cs_main, cs_wallet);
+        pindexLast = vBatch[0]->pprev;
+        for (unsigned int i = 0; i < vBatch.size(); i++) {
+            pindex = vBatch[i];
+            // a reorganization while the batch was read took this block out of the active chain,
+            // the next batch starts over from where it forked
+            if (!chainActive.Contains(pindex))
+                break;
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+            CBlock& block = vBlocks[i];
+            for (unsigned int j = 0; j < block.vtx.size(); j++) {
+                const CTransaction& tx = block.vtx[j];
+
+                // transactions that pay us were found by the scan threads, the others
+                // can only involve us by spending one of our transactions
+                bool fInvolved = vMatches[i][j] || mapWallet.count(tx.GetHash()) != 0;
+                for (unsigned int n = 0; !fInvolved && n < tx.vin.size(); n++)
+                    fInvolved = mapWallet.count(tx.vin[n].prevout.hash) != 0;
+                if (fInvolved && AddToWalletIfInvolvingMe(tx, &block, fUpdate))
                     ret++;
             }
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
+            pindexLast = pindex;
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1269,19 +1417,112 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::GetBalance() const
+CWalletBalances CWallet::GetTxBalances(const CWalletTx& wtx, bool& fVolatile) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    CWalletBalances balances;
+    bool fFinal = IsFinalTx(wtx);
+    bool fTrusted = wtx.IsTrusted();
+    int nDepth = wtx.GetDepthInMainChain();
+    bool fUnconfirmed = !fFinal || (!fTrusted && nDepth == 0);
+
+    if (fTrusted) {
+        balances.nAvailable = wtx.GetAvailableCredit();
+        balances.nWatchOnly = wtx.GetAvailableWatchOnlyCredit();
+    }
+    if (fUnconfirmed) {
+        balances.nUnconfirmed = wtx.GetAvailableCredit();
+        balances.nUnconfirmedWatchOnly = wtx.GetAvailableWatchOnlyCredit();
+    }
+    balances.nImmature = wtx.GetImmatureCredit();
+    balances.nImmatureWatchOnly = wtx.GetImmatureWatchOnlyCredit();
+
+    if (!fLiteMode) {
+        if (fTrusted) {
+            balances.nAnonymizable = wtx.GetAnonymizableCredit();
+            balances.nAnonymized = wtx.GetAnonymizedCredit();
+        }
+        balances.nDenominated = wtx.GetDenominatedCredit(false);
+        balances.nDenominatedUnconfirmed = wtx.GetDenominatedCredit(true);
+        if (fTrusted && nDepth > 0) {
+            balances.nLocked = wtx.GetLockedCredit();
+            balances.nUnlocked = wtx.GetUnlockedCredit();
         }
     }
 
-    return nTotal;
+    fVolatile = !fFinal || wtx.GetDepthInMainChain(false) <= 0 || wtx.GetBlocksToMaturity() > 0;
+    return balances;
+}
+
+void CWallet::UpdateTxBalances(const uint256& hash, const CWalletTx* pwtx) const
+{
+    map<uint256, CWalletBalances>::iterator it = mapTxBalances.find(hash);
+    if (it != mapTxBalances.end()) {
+        balancesTotal -= it->second;
+        mapTxBalances.erase(it);
+    }
+    setBalancesVolatile.erase(hash);
+    if (!pwtx)
+        return;
+
+    bool fVolatile;
+    CWalletBalances balances = GetTxBalances(*pwtx, fVolatile);
+    if (!balances.IsNull()) {
+        balancesTotal += balances;
+        mapTxBalances.insert(make_pair(hash, balances));
+    }
+    if (fVolatile)
+        setBalancesVolatile.insert(hash);
+}
+
+const CWalletBalances& CWallet::UpdateBalances() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (!fBalancesLoaded) {
+        balancesTotal.SetNull();
+        mapTxBalances.clear();
+        setBalancesDirty.clear();
+        setBalancesVolatile.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            UpdateTxBalances(it->first, &it->second);
+        fBalancesLoaded = true;
+    } else {
+        std::set<uint256> setUpdate;
+        setUpdate.swap(setBalancesDirty);
+        setUpdate.insert(setBalancesVolatile.begin(), setBalancesVolatile.end());
+        BOOST_FOREACH (const uint256& hash, setUpdate) {
+            map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+            UpdateTxBalances(hash, mi != mapWallet.end() ? &mi->second : NULL);
+        }
+    }
+
+    CheckBalances();
+    return balancesTotal;
+}
+
+void CWallet::CheckBalances() const
+{
+#ifdef DEBUG
+    CWalletBalances balances;
+    bool fVolatile;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        balances += GetTxBalances(it->second, fVolatile);
+    assert(balances == balancesTotal);
+#endif
+}
+
+void CWallet::MarkBalancesDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (fBalancesLoaded)
+        setBalancesDirty.insert(hash);
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nAvailable;
 }
 
 CAmount CWallet::GetZerocoinBalance(bool fMatureOnly) const
@@ -1355,36 +1596,16 @@ CAmount CWallet::GetUnlockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetUnlockedCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nUnlocked;
 }
 
 CAmount CWallet::GetLockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
-                nTotal += pcoin->GetLockedCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nLocked;
 }
 
 // Get a Map pairing the Denominations with the amount of Zerocoin for each Denomination
@@ -1407,36 +1628,16 @@ CAmount CWallet::GetAnonymizableBalance() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAnonymizableCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nAnonymizable;
 }
 
 CAmount CWallet::GetAnonymizedBalance() const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAnonymizedCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -1506,86 +1707,39 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if (fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    const CWalletBalances& balances = UpdateBalances();
+    return unconfirmed ? balances.nDenominatedUnconfirmed : balances.nDenominated;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nImmatureWatchOnly;
 }
 
 /**
@@ -1745,10 +1899,93 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
     return (!found1 && found2);
 }
 
+bool CWallet::IsStakeableOutput(const CTxOut& txout) const
+{
+    if (txout.nValue <= 0 || txout.IsZerocoinMint())
+        return false;
+
+    isminetype mine = IsMine(txout);
+    return mine != ISMINE_NO && mine != ISMINE_WATCH_ONLY;
+}
+
+void CWallet::AddToStakeableCoins(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fStakeableCoinsLoaded)
+        return;
+
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsStakeableOutput(wtx.vout[i]))
+            setStakeableCoins.insert(COutPoint(hash, i));
+    }
+
+    // A change to a spending transaction (conflicted, disconnected, erased) can release the outputs it spends.
+    // Outputs that are still spent are dropped again by the next AvailableStakeCoins.
+    if (wtx.IsCoinBase() || wtx.IsZerocoinSpend())
+        return;
+    BOOST_FOREACH (const CTxIn& txin, wtx.vin) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size() && IsStakeableOutput(mi->second.vout[txin.prevout.n]))
+            setStakeableCoins.insert(txin.prevout);
+    }
+}
+
+/**
+ * Same selection as AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS), but only
+ * over the outputs in setStakeableCoins instead of every transaction in the wallet.
+ */
+void CWallet::AvailableStakeCoins(vector<COutput>& vCoins) const
+{
+    vCoins.clear();
+
+    LOCK2(cs_main, cs_wallet);
+    if (!fStakeableCoinsLoaded) {
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            for (unsigned int i = 0; i < it->second.vout.size(); i++) {
+                if (IsStakeableOutput(it->second.vout[i]) && !IsSpent(it->first, i))
+                    setStakeableCoins.insert(COutPoint(it->first, i));
+            }
+        }
+        fStakeableCoinsLoaded = true;
+    }
+
+    std::set<COutPoint>::const_iterator it = setStakeableCoins.begin();
+    while (it != setStakeableCoins.end()) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->hash);
+        if (mi == mapWallet.end() || IsSpentInMainChain(it->hash, it->n)) {
+            setStakeableCoins.erase(it++);
+            continue;
+        }
+        // an unconfirmed spender can be conflicted without being updated in the wallet, keep the output until it confirms
+        if (IsSpent(it->hash, it->n)) {
+            ++it;
+            continue;
+        }
+        const CWalletTx* pcoin = &mi->second;
+        unsigned int i = (it++)->n;
+
+        if (!CheckFinalTx(*pcoin) || !pcoin->IsTrusted())
+            continue;
+
+        if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
+            continue;
+
+        int nDepth = pcoin->GetDepthInMainChain(false);
+        if (nDepth == 0 && !pcoin->InMempool())
+            continue;
+
+        if (IsLockedCoin(pcoin->GetHash(), i))
+            continue;
+
+        vCoins.emplace_back(COutput(pcoin, i, nDepth, true));
+    }
+}
+
 bool CWallet::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const
 {
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
+    AvailableStakeCoins(vCoins);
     CAmount nAmountSelected = 0;
 
     for (const COutput& out : vCoins) {
@@ -1787,8 +2024,9 @@ bool CWallet::MintableCoins()
     if (nBalance <= nReserveBalance)
         return false;
 
+    //only outputs SelectStakeCoins could pick count, zerocoin mint outputs are never staked
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true);
+    AvailableStakeCoins(vCoins);
 
     for (const COutput& out : vCoins) {
         int64_t nTxTime = out.tx->GetTxTime();
@@ -2563,87 +2801,84 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
         MilliSleep(10000);
 
+    std::vector<PAIRTYPE(const CWalletTx*, unsigned int)> vStakeCoins;
+    std::vector<CStakeCandidate> vCandidates;
+    vStakeCoins.reserve(setStakeCoins.size());
+    vCandidates.reserve(setStakeCoins.size());
     BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins) {
         //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
         BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
+        if (it == mapBlockIndex.end()) {
             if (fDebug)
                 LogPrintf("CreateCoinStake() failed to find block index \n");
             continue;
         }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
+        vStakeCoins.push_back(pcoin);
+        vCandidates.push_back(CStakeCandidate(COutPoint(pcoin.first->GetHash(), pcoin.second), pcoin.first->vout[pcoin.second].nValue, it->second));
+    }
 
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+    //hash the time window of every coin, spread over the kernel search threads
+    int nCandidate = -1;
+    uint256 hashProofOfStake = 0;
+    nTxNewTime = GetAdjustedTime();
+    if (SearchStakeKernel(nBits, vCandidates, nHashDrift, nCandidate, nTxNewTime, hashProofOfStake)) {
+        PAIRTYPE(const CWalletTx*, unsigned int) pcoin = vStakeCoins[nCandidate];
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
+        //Double check that this will pass time requirements
+        if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
+            LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
+            return false;
+        }
 
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
-
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
+        // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : kernel found\n");
+
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+            LogPrintf("CreateCoinStake : failed to parse kernel\n");
+            return false;
+        }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            return false; // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            //convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
                 if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                return false; // unable to find corresponding public key
             }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        } else
+            scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+        nCredit += pcoin.first->vout[pcoin.second].nValue;
+        vwtxPrev.push_back(pcoin.first);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight);
+        //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+        const CBlockIndex* pIndex0 = chainActive.Tip();
+        uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight);
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+        //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+        if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
     }
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
@@ -3360,18 +3595,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalancesDirty(output.hash);
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalancesDirty(output.hash);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    fBalancesLoaded = false;
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -3509,6 +3747,126 @@ bool CWallet::LoadDestData(const CTxDestination& dest, const std::string& key, c
     return true;
 }
 
+static uint256 GetZerocoinValueHash(const CBigNum& bnValue)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnValue;
+    return Hash(ss.begin(), ss.end());
+}
+
+void CWallet::AddZerocoinMint(const CZerocoinMint& mint)
+{
+    LOCK(cs_wallet);
+    setZerocoinMintSerialHashes.insert(GetZerocoinValueHash(mint.GetSerialNumber()));
+    mapZerocoinMints[GetZerocoinValueHash(mint.GetValue())] = mint;
+}
+
+bool CWallet::IsMyZerocoinMintSerial(const CBigNum& bnSerial) const
+{
+    LOCK(cs_wallet);
+    return setZerocoinMintSerialHashes.count(GetZerocoinValueHash(bnSerial)) != 0;
+}
+
+void CWallet::LoadZerocoinWitnessState(const CAccumulatorWitnessState& state)
+{
+    LOCK(cs_wallet);
+    mapZerocoinWitnessStates[GetZerocoinValueHash(state.bnPubcoin)] = state;
+}
+
+void CWallet::UpdateZerocoinWitnessStates()
+{
+    std::vector<CZerocoinMint> vMints;
+    {
+        LOCK(cs_wallet);
+        for (std::map<uint256, CZerocoinMint>::const_iterator it = mapZerocoinMints.begin(); it != mapZerocoinMints.end(); ++it)
+            vMints.push_back(it->second);
+    }
+
+    // one witness at a time, so that neither lock is held for the whole pass
+    std::set<uint256> setUnspentHashes;
+    for (const CZerocoinMint& mint : vMints) {
+        boost::this_thread::interruption_point();
+
+        // a spend in the chain ends the mint's need for a witness; MintToTxIn still builds one on demand
+        uint256 hashPubcoin = GetZerocoinValueHash(mint.GetValue());
+        uint256 txidSpend;
+        if (zerocoinDB->ReadCoinSpend(mint.GetSerialNumber(), txidSpend)) {
+            LOCK(cs_wallet);
+            mapZerocoinMints.erase(hashPubcoin);
+            continue;
+        }
+
+        CAccumulatorWitnessState state;
+        {
+            LOCK(cs_wallet);
+            std::map<uint256, CAccumulatorWitnessState>::const_iterator it = mapZerocoinWitnessStates.find(hashPubcoin);
+            if (it != mapZerocoinWitnessStates.end())
+                state = it->second;
+        }
+
+        int nHeightBefore = state.snapshotLatest.nHeight;
+        libzerocoin::PublicCoin pubcoin(Params().Zerocoin_Params(), mint.GetValue(), mint.GetDenomination());
+        {
+            LOCK(cs_main);
+            if (!UpdateAccumulatorWitnessState(pubcoin, state))
+                LogPrint("zero", "%s : failed to update witness of mint %s\n", __func__, mint.GetValue().GetHex());
+        }
+        if (state.IsNull())
+            continue;
+
+        LOCK(cs_wallet);
+        setUnspentHashes.insert(hashPubcoin);
+        // MintToTxIn may have advanced or replaced the stored state meanwhile; keep its result then
+        std::map<uint256, CAccumulatorWitnessState>::iterator it = mapZerocoinWitnessStates.find(hashPubcoin);
+        int nHeightStored = it == mapZerocoinWitnessStates.end() ? 0 : it->second.snapshotLatest.nHeight;
+        if (nHeightStored != nHeightBefore)
+            continue;
+        mapZerocoinWitnessStates[hashPubcoin] = state;
+        if (fFileBacked && state.snapshotLatest.nHeight != nHeightBefore)
+            CWalletDB(strWalletFile).WriteZerocoinWitnessState(state);
+    }
+
+    // forget the witnesses of the mints of this pass that were spent or are no longer in the chain,
+    // mints added since the copy above are left to the next pass
+    LOCK(cs_wallet);
+    for (const CZerocoinMint& mint : vMints) {
+        uint256 hashPubcoin = GetZerocoinValueHash(mint.GetValue());
+        std::map<uint256, CAccumulatorWitnessState>::iterator it = mapZerocoinWitnessStates.find(hashPubcoin);
+        if (setUnspentHashes.count(hashPubcoin) || it == mapZerocoinWitnessStates.end())
+            continue;
+        if (fFileBacked)
+            CWalletDB(strWalletFile).EraseZerocoinWitnessState(it->second.bnPubcoin);
+        mapZerocoinWitnessStates.erase(it);
+    }
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    // witnesses only move forward when a new accumulator checkpoint is generated; the
+    // update itself reads blocks, so it is left to ThreadZerocoinWitnessUpdate
+    if (pindex->nHeight % 10 == 0) {
+        boost::unique_lock<boost::mutex> lock(cs_zerocoinWitnessUpdate);
+        fZerocoinWitnessesStale = true;
+        condZerocoinWitnessUpdate.notify_one();
+    }
+}
+
+void ThreadZerocoinWitnessUpdate(CWallet* pwallet)
+{
+    RenameThread("umbra-zcwitness");
+
+    while (true) {
+        {
+            // waiting is an interruption point, so shutdown does not need a wakeup of its own
+            boost::unique_lock<boost::mutex> lock(pwallet->cs_zerocoinWitnessUpdate);
+            while (!pwallet->fZerocoinWitnessesStale)
+                pwallet->condZerocoinWitnessUpdate.wait(lock);
+            pwallet->fZerocoinWitnessesStale = false;
+        }
+        pwallet->UpdateZerocoinWitnessStates();
+    }
+}
+
 bool CWallet::GetDestData(const CTxDestination& dest, const std::string& key, std::string* value) const
 {
     std::map<CTxDestination, CAddressBookData>::const_iterator i = mapAddressBook.find(dest);
@@ -4078,7 +4436,15 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason)) {
+    uint256 hashPubcoin = GetZerocoinValueHash(pubCoinSelected.getValue());
+    CAccumulatorWitnessState& witnessState = mapZerocoinWitnessStates[hashPubcoin];
+    bool fWitness = GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, &witnessState);
+    if (witnessState.IsNull())
+        mapZerocoinWitnessStates.erase(hashPubcoin);
+    else if (fFileBacked)
+        CWalletDB(strWalletFile).WriteZerocoinWitnessState(witnessState);
+
+    if (!fWitness) {
         receipt.SetStatus("Try to spend with a higher security level to include more coins", ZUMB_FAILED_ACCUMULATOR_INITIALIZATION);
         LogPrintf("%s : %s \n", __func__, receipt.GetStatusMessage());
         return false;
@@ -4439,6 +4805,7 @@ void CWallet::ReconsiderZerocoins(std::list<CZerocoinMint>& listMintsRestored)
         if (!walletdb.UnarchiveZerocoin(mint)) {
             LogPrintf("%s : failed to unarchive mint %s\n", __func__, mint.GetValue().GetHex());
         }
+        AddZerocoinMint(mint);
         listMintsRestored.emplace_back(mint);
     }
 }
@@ -4523,6 +4890,7 @@ string CWallet::MintZerocoin(CAmount nValue, CWalletTx& wtxNew, vector<CZerocoin
         for (CZerocoinMint mint : vMints) {
             mint.SetTxHash(wtxNew.GetHash());
             walletdb.WriteZerocoinMint(mint);
+            AddZerocoinMint(mint);
             pwalletMain->NotifyZerocoinChanged(pwalletMain, mint.GetValue().GetHex(), "Used", CT_UPDATED);
         }
     }
@@ -4609,6 +4977,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
     for (CZerocoinMint mint : vNewMints) {
         mint.SetTxHash(wtxNew.GetHash());
         walletdb.WriteZerocoinMint(mint);
+        AddZerocoinMint(mint);
     }
 
     receipt.SetStatus("Spend Successful", ZUMB_SPEND_OKAY);  // When we reach this point spending zUMB was successful
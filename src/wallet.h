@@ -8,6 +8,7 @@
 #ifndef BITCOIN_WALLET_H
 #define BITCOIN_WALLET_H
 
+#include "accumulators.h"
 #include "amount.h"
 #include "base58.h"
 #include "crypter.h"
@@ -33,6 +34,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/unordered_set.hpp>
+
 /**
  * Settings
  */
@@ -54,6 +57,8 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 1 * COIN;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Number of blocks read in parallel per step of a wallet rescan
+static const unsigned int WALLET_SCAN_BATCH_SIZE = 100;
 
 // Zerocoin denomination which creates exactly one of each denominations:
 // 11235 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
@@ -114,6 +119,89 @@ struct CompactTallyItem {
     }
 };
 
+/** Contribution of wallet transactions to each of the wallet balances */
+struct CWalletBalances {
+    CAmount nAvailable;
+    CAmount nUnconfirmed;
+    CAmount nImmature;
+    CAmount nWatchOnly;
+    CAmount nUnconfirmedWatchOnly;
+    CAmount nImmatureWatchOnly;
+    CAmount nAnonymizable;
+    CAmount nAnonymized;
+    CAmount nDenominated;
+    CAmount nDenominatedUnconfirmed;
+    CAmount nLocked;
+    CAmount nUnlocked;
+
+    CWalletBalances()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nAvailable = nUnconfirmed = nImmature = 0;
+        nWatchOnly = nUnconfirmedWatchOnly = nImmatureWatchOnly = 0;
+        nAnonymizable = nAnonymized = nDenominated = nDenominatedUnconfirmed = 0;
+        nLocked = nUnlocked = 0;
+    }
+
+    bool IsNull() const
+    {
+        return *this == CWalletBalances();
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b)
+    {
+        nAvailable += b.nAvailable;
+        nUnconfirmed += b.nUnconfirmed;
+        nImmature += b.nImmature;
+        nWatchOnly += b.nWatchOnly;
+        nUnconfirmedWatchOnly += b.nUnconfirmedWatchOnly;
+        nImmatureWatchOnly += b.nImmatureWatchOnly;
+        nAnonymizable += b.nAnonymizable;
+        nAnonymized += b.nAnonymized;
+        nDenominated += b.nDenominated;
+        nDenominatedUnconfirmed += b.nDenominatedUnconfirmed;
+        nLocked += b.nLocked;
+        nUnlocked += b.nUnlocked;
+        return *this;
+    }
+
+    CWalletBalances& operator-=(const CWalletBalances& b)
+    {
+        nAvailable -= b.nAvailable;
+        nUnconfirmed -= b.nUnconfirmed;
+        nImmature -= b.nImmature;
+        nWatchOnly -= b.nWatchOnly;
+        nUnconfirmedWatchOnly -= b.nUnconfirmedWatchOnly;
+        nImmatureWatchOnly -= b.nImmatureWatchOnly;
+        nAnonymizable -= b.nAnonymizable;
+        nAnonymized -= b.nAnonymized;
+        nDenominated -= b.nDenominated;
+        nDenominatedUnconfirmed -= b.nDenominatedUnconfirmed;
+        nLocked -= b.nLocked;
+        nUnlocked -= b.nUnlocked;
+        return *this;
+    }
+
+    friend bool operator==(const CWalletBalances& a, const CWalletBalances& b)
+    {
+        return a.nAvailable == b.nAvailable && a.nUnconfirmed == b.nUnconfirmed && a.nImmature == b.nImmature &&
+               a.nWatchOnly == b.nWatchOnly && a.nUnconfirmedWatchOnly == b.nUnconfirmedWatchOnly && a.nImmatureWatchOnly == b.nImmatureWatchOnly &&
+               a.nAnonymizable == b.nAnonymizable && a.nAnonymized == b.nAnonymized &&
+               a.nDenominated == b.nDenominated && a.nDenominatedUnconfirmed == b.nDenominatedUnconfirmed &&
+               a.nLocked == b.nLocked && a.nUnlocked == b.nUnlocked;
+    }
+};
+
+/** Run an instance of the wallet rescan block reading thread */
+void ThreadWalletScan();
+
+/** Advance the accumulator witnesses of the wallet's mints whenever a new checkpoint is connected */
+void ThreadZerocoinWitnessUpdate(CWallet* pwallet);
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -185,6 +273,36 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Our outputs that can be staked once they are mature, so a staking round
+     * does not have to walk the whole of mapWallet. Outputs are added when a
+     * transaction creating or spending them changes and dropped lazily by
+     * AvailableStakeCoins once they are spent in the main chain. A spender that
+     * is disconnected releases them again through AddToWallet, one that is still
+     * unconfirmed only hides them. Loaded on first use.
+     */
+    mutable std::set<COutPoint> setStakeableCoins;
+    mutable bool fStakeableCoinsLoaded;
+    bool IsStakeableOutput(const CTxOut& txout) const;
+    bool IsSpentInMainChain(const uint256& hash, unsigned int n) const;
+    void AddToStakeableCoins(const CWalletTx& wtx);
+
+    /**
+     * Wallet balances summed over the non-null contributions in mapTxBalances.
+     * Transactions are recalculated when they are marked dirty, and on every
+     * query while they are unconfirmed, immature or not final, since those
+     * change with the chain without the wallet being told. Loaded on first use.
+     */
+    mutable CWalletBalances balancesTotal;
+    mutable std::map<uint256, CWalletBalances> mapTxBalances;
+    mutable std::set<uint256> setBalancesDirty;
+    mutable std::set<uint256> setBalancesVolatile;
+    mutable bool fBalancesLoaded;
+    CWalletBalances GetTxBalances(const CWalletTx& wtx, bool& fVolatile) const;
+    void UpdateTxBalances(const uint256& hash, const CWalletTx* pwtx) const;
+    const CWalletBalances& UpdateBalances() const;
+    void CheckBalances() const;
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
@@ -229,6 +347,21 @@ public:
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
 
+    //! Hashes of the serial numbers of our zerocoin mints, so spends of them can be spotted without a database scan
+    boost::unordered_set<uint256, BlockHasher> setZerocoinMintSerialHashes;
+
+    //! Our zerocoin mints keyed by pubcoin hash, so their witnesses can be kept up without a database scan
+    std::map<uint256, CZerocoinMint> mapZerocoinMints;
+
+    //! Incrementally maintained accumulator witnesses of our unspent mints, keyed by pubcoin hash
+    std::map<uint256, CAccumulatorWitnessState> mapZerocoinWitnessStates;
+
+    //! Whether a new accumulator checkpoint was connected since the witnesses were last advanced,
+    //! guarded by cs_zerocoinWitnessUpdate; condZerocoinWitnessUpdate wakes ThreadZerocoinWitnessUpdate when set
+    bool fZerocoinWitnessesStale;
+    boost::mutex cs_zerocoinWitnessUpdate;
+    boost::condition_variable condZerocoinWitnessUpdate;
+
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
     MasterKeyMap mapMasterKeys;
     unsigned int nMasterKeyMaxID;
@@ -283,12 +416,15 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        fZerocoinWitnessesStale = false;
 
         // Stake Settings
         nHashDrift = 45;
         nStakeSplitThreshold = 500;
         nHashInterval = 22;
         nStakeSetUpdateTime = 300; // 5 minutes
+        fStakeableCoinsLoaded = false;
+        fBalancesLoaded = false;
 
         //MultiSend
         vMultiSend.clear();
@@ -348,6 +484,7 @@ public:
     }
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL, bool fIncludeZeroValue = false, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false) const;
+    void AvailableStakeCoins(std::vector<COutput>& vCoins) const;
     std::map<CBitcoinAddress, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
@@ -400,6 +537,15 @@ public:
     //! Look up a destination data tuple in the store, return true if found false otherwise
     bool GetDestData(const CTxDestination& dest, const std::string& key, std::string* value) const;
 
+    //! Adds one of our zerocoin mints and its serial number to the in-memory indexes (also used by LoadWallet)
+    void AddZerocoinMint(const CZerocoinMint& mint);
+    //! Whether the serial number belongs to one of our zerocoin mints
+    bool IsMyZerocoinMintSerial(const CBigNum& bnSerial) const;
+    //! Adds a stored accumulator witness of one of our mints (used by LoadWallet)
+    void LoadZerocoinWitnessState(const CAccumulatorWitnessState& state);
+    //! Advances the stored accumulator witnesses of our unspent mints to the active chain
+    void UpdateZerocoinWitnessStates();
+
     //! Adds a watch-only address to the store, and saves it to disk.
     bool AddWatchOnly(const CScript& dest);
     bool RemoveWatchOnly(const CScript& dest);
@@ -435,8 +581,10 @@ public:
     TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
 
     void MarkDirty();
+    void MarkBalancesDirty(const uint256& hash) const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
@@ -926,6 +1074,8 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        if (pwallet)
+            pwallet->MarkBalancesDirty(GetHash());
     }
 
     void BindWallet(CWallet* pwalletIn)
@@ -657,6 +657,14 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
                 strErr = "Error reading wallet database: LoadDestData failed";
                 return false;
             }
+        } else if (strType == "zerocoin") {
+            CZerocoinMint mint;
+            ssValue >> mint;
+            pwallet->AddZerocoinMint(mint);
+        } else if (strType == "zcwitness") {
+            CAccumulatorWitnessState state;
+            ssValue >> state;
+            pwallet->LoadZerocoinWitnessState(state);
         }
     } catch (...) {
         return false;
@@ -1041,6 +1049,24 @@ bool CWalletDB::ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial)
     return Read(make_pair(string("zcserial"), bnSerial), spend);
 }
 
+bool CWalletDB::WriteZerocoinWitnessState(const CAccumulatorWitnessState& state)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << state.bnPubcoin;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Write(make_pair(string("zcwitness"), hash), state, true);
+}
+
+bool CWalletDB::EraseZerocoinWitnessState(const CBigNum& bnPubcoin)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubcoin;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Erase(make_pair(string("zcwitness"), hash));
+}
+
 bool CWalletDB::WriteZerocoinMint(const CZerocoinMint& zerocoinMint)
 {
     CDataStream ss(SER_GETHASH, 0);
@@ -1188,7 +1214,7 @@ std::list<CZerocoinMint> CWalletDB::ListMintedCoins(bool fUnusedOnly, bool fMatu
                 CBlockIndex *pindex = chainActive[mint.GetHeight() + 1];
                 int nMintsAdded = 0;
                 while(pindex->nHeight < chainActive.Height() - 30) { // 30 just to make sure that its at least 2 checkpoints from the top block
-                    nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), mint.GetDenomination());
+                    nMintsAdded += pindex->mintsInBlock.Count(mint.GetDenomination());
                     if(nMintsAdded >= Params().Zerocoin_RequiredAccumulation())
                         break;
                     pindex = chainActive[pindex->nHeight + 1];
@@ -1217,17 +1243,6 @@ std::list<CZerocoinMint> CWalletDB::ListMintedCoins(bool fUnusedOnly, bool fMatu
 
     return listPubCoin;
 }
-// Just get the Serial Numbers
-std::list<CBigNum> CWalletDB::ListMintedCoinsSerial()
-{
-    std::list<CBigNum> listPubCoin;
-    std::list<CZerocoinMint> listCoins = ListMintedCoins(true, false, false);
-    
-    for ( auto& coin : listCoins) {
-        listPubCoin.push_back(coin.GetSerialNumber());
-    }
-    return listPubCoin;
-}
 
 
 std::list<CZerocoinSpend> CWalletDB::ListSpentCoins()
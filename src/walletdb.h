@@ -30,6 +30,7 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class CAccumulatorWitnessState;
 class CZerocoinMint;
 class CZerocoinSpend;
 class uint160;
@@ -156,12 +157,13 @@ public:
     bool UnarchiveZerocoin(const CZerocoinMint& mint);
     std::list<CZerocoinMint> ListMintedCoins(bool fUnusedOnly, bool fMaturedOnly, bool fUpdateStatus);
     std::list<CZerocoinSpend> ListSpentCoins();
-    std::list<CBigNum> ListMintedCoinsSerial();
     std::list<CBigNum> ListSpentCoinsSerial();
     std::list<CZerocoinMint> ListArchivedZerocoins();
     bool WriteZerocoinSpendSerialEntry(const CZerocoinSpend& zerocoinSpend);
     bool EraseZerocoinSpendSerialEntry(const CBigNum& serialEntry);
     bool ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial);
+    bool WriteZerocoinWitnessState(const CAccumulatorWitnessState& state);
+    bool EraseZerocoinWitnessState(const CBigNum& bnPubcoin);
 
 private:
     CWalletDB(const CWalletDB&);
@@ -0,0 +1,92 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zerocoinspendcache.h"
+
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Verified zerocoin spend cache, to avoid checking the expensive libzerocoin
+ * spend proofs twice for every spend (once when accepted into memory pool,
+ * and again when the block containing it is checked)
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! entries are salted hashes of (spend input script, accumulator checksum)
+    std::set<uint256> setValid;
+    //! per-node salt, so entry placement (and thus eviction) can't be predicted by peers
+    uint256 nSalt;
+    boost::shared_mutex cs_zerocoinspendcache;
+
+    uint256 GetEntry(const CTxIn& txin, uint32_t nAccumulatorChecksum) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nSalt << txin.scriptSig << nAccumulatorChecksum;
+        return ss.GetHash();
+    }
+
+public:
+    CZerocoinSpendCache()
+    {
+        nSalt = GetRandHash();
+    }
+
+    bool Get(const CTxIn& txin, uint32_t nAccumulatorChecksum)
+    {
+        uint256 entry = GetEntry(txin, nAccumulatorChecksum);
+
+        boost::shared_lock<boost::shared_mutex> lock(cs_zerocoinspendcache);
+        return setValid.count(entry) != 0;
+    }
+
+    void Set(const CTxIn& txin, uint32_t nAccumulatorChecksum)
+    {
+        // DoS prevention: entries are only the 32 byte salted hash of the
+        // spend, so the default keeps this around 1MB
+        int64_t nMaxCacheSize = GetArg("-maxzerocoinspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        uint256 entry = GetEntry(txin, nAccumulatorChecksum);
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_zerocoinspendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize)
+        {
+            // Evict a random entry, as CSignatureCache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+};
+
+CZerocoinSpendCache& GetZerocoinSpendCache()
+{
+    static CZerocoinSpendCache zerocoinSpendCache;
+    return zerocoinSpendCache;
+}
+
+}
+
+bool IsZerocoinSpendVerified(const CTxIn& txin, uint32_t nAccumulatorChecksum)
+{
+    return GetZerocoinSpendCache().Get(txin, nAccumulatorChecksum);
+}
+
+void SetZerocoinSpendVerified(const CTxIn& txin, uint32_t nAccumulatorChecksum)
+{
+    GetZerocoinSpendCache().Set(txin, nAccumulatorChecksum);
+}
@@ -0,0 +1,24 @@
+// Copyright (c) 2017-2018 The Umbra developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef UMBRA_ZEROCOINSPENDCACHE_H
+#define UMBRA_ZEROCOINSPENDCACHE_H
+
+#include <stdint.h>
+
+class CTxIn;
+
+/** Default for -maxzerocoinspendcachesize, the number of verified zerocoin spends remembered */
+static const unsigned int DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 10000;
+
+/**
+ * Whether the spend proof carried by txin is already known to verify against
+ * the accumulator with the given checksum.
+ */
+bool IsZerocoinSpendVerified(const CTxIn& txin, uint32_t nAccumulatorChecksum);
+
+/** Remember that the spend proof carried by txin verified against the accumulator with the given checksum */
+void SetZerocoinSpendVerified(const CTxIn& txin, uint32_t nAccumulatorChecksum);
+
+#endif // UMBRA_ZEROCOINSPENDCACHE_H